@@ -0,0 +1,289 @@
+// Benchmarks the phases of iteration 2 over every sorted quadruple in a
+// range: enumerating the trees, evaluating them, canonicalizing and hashing
+// them and printing the solutions. Each phase is measured with hardware
+// counters where perf_event_open allows it and with the wall clock always.
+// syscall() is not part of POSIX.
+#define _DEFAULT_SOURCE
+#define main xmain
+#include "../iteration2.c"
+#undef main
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+enum {
+  counter_cycles,
+  counter_instructions,
+  counter_branch_misses,
+  counter_l1d_misses,
+  counter_count
+};
+
+static const char *const counterNames[counter_count] = {
+    "cycles", "instructions", "branch-misses", "L1d-misses"};
+
+struct Counters {
+  int fds[counter_count];
+  uint64_t values[counter_count];
+  uint64_t nanoseconds;
+};
+
+static void openCounters(struct Counters *counters) {
+  for (int i = 0; i < counter_count; ++i) {
+    counters->fds[i] = -1;
+  }
+#ifdef __linux__
+  static const struct {
+    uint32_t type;
+    uint64_t config;
+  } events[counter_count] = {
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+      {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                               PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                               PERF_COUNT_HW_CACHE_RESULT_MISS << 16}};
+  for (int i = 0; i < counter_count; ++i) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    counters->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (counters->fds[i] < 0) {
+      fprintf(stderr, "note: Can't count %s: %s\n", counterNames[i],
+              strerror(errno));
+    }
+  }
+#else
+  fputs("note: Hardware counters are unavailable, reporting time only\n",
+        stderr);
+#endif
+}
+
+static void closeCounters(struct Counters *counters) {
+  for (int i = 0; i < counter_count; ++i) {
+    if (counters->fds[i] >= 0) {
+      close(counters->fds[i]);
+    }
+  }
+}
+
+static void startCounters(struct Counters *counters) {
+#ifdef __linux__
+  for (int i = 0; i < counter_count; ++i) {
+    if (counters->fds[i] >= 0) {
+      ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+#endif
+  counters->nanoseconds = monotonicNanoseconds();
+}
+
+static void stopCounters(struct Counters *counters) {
+  counters->nanoseconds = monotonicNanoseconds() - counters->nanoseconds;
+  for (int i = 0; i < counter_count; ++i) {
+    counters->values[i] = 0;
+#ifdef __linux__
+    if (counters->fds[i] < 0) {
+      continue;
+    }
+    ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    // Scale the count up if the counter had to share the hardware.
+    uint64_t value[3];
+    if (read(counters->fds[i], value, sizeof(value)) == sizeof(value) &&
+        value[2] > 0) {
+      counters->values[i] = (uint64_t)((double)value[0] * value[1] / value[2]);
+    }
+#endif
+  }
+}
+
+// Every operator triple times every wiring of the operators.
+enum { max_trees = tree_count };
+
+// The trees of one puzzle, collected before any phase is measured.
+struct Workload {
+  int numbers[number_count];
+  PackedTree trees[max_trees];
+  size_t treeCount;
+  uint16_t hashes[max_trees];
+  bool solved[max_trees];
+  PackedTree solutions[max_trees];
+  // Kept across puzzles, like the solver's, so the print phase measures
+  // the same mix of cache hits and template compiles.
+  struct TemplateCache templates;
+};
+
+static void collectTree(PackedTree tree, const int numbers[], void *data) {
+  (void)numbers;
+  struct Workload *workload = data;
+  workload->trees[workload->treeCount++] = tree;
+}
+
+// Keeps the enumeration phase from being optimized away.
+static volatile PackedTree enumerationChecksum;
+
+static void sinkTree(PackedTree tree, const int numbers[], void *data) {
+  (void)numbers;
+  *(PackedTree *)data ^= tree;
+}
+
+enum Phase {
+  phase_enumerate,
+  phase_evaluate,
+  phase_canonicalize,
+  phase_hash,
+  phase_print,
+  phase_count
+};
+
+static const char *const phaseNames[phase_count] = {
+    "enumerate", "evaluate", "canonicalize", "hash", "print"};
+
+struct PhaseTotals {
+  uint64_t items, nanoseconds, values[counter_count];
+};
+
+static void addCounters(struct PhaseTotals *totals,
+                        const struct Counters *counters, size_t items) {
+  totals->items += items;
+  totals->nanoseconds += counters->nanoseconds;
+  for (int i = 0; i < counter_count; ++i) {
+    totals->values[i] += counters->values[i];
+  }
+}
+
+static void measurePuzzle(struct Workload *workload, struct Counters *counters,
+                          FILE *sink, struct PhaseTotals totals[phase_count]) {
+  PackedTree checksum = 0;
+  startCounters(counters);
+  iteratePackedTrees(workload->numbers, sinkTree, &checksum);
+  stopCounters(counters);
+  workload->treeCount = 0;
+  iteratePackedTrees(workload->numbers, collectTree, workload);
+  addCounters(totals + phase_enumerate, counters, workload->treeCount);
+
+  // Only solutions are canonicalized, hashed and printed by the solver, but
+  // every tree is canonicalized and hashed here to measure per tree costs.
+  startCounters(counters);
+  for (size_t i = 0; i < workload->treeCount; ++i) {
+    const EvalResult res =
+        evalPackedTree(workload->trees[i], workload->numbers, all_count - 1);
+    workload->solved[i] = res.valid && res.num == target_number;
+  }
+  stopCounters(counters);
+  addCounters(totals + phase_evaluate, counters, workload->treeCount);
+
+  unsigned char classes[number_count];
+  numberClasses(workload->numbers, classes);
+  startCounters(counters);
+  for (size_t i = 0; i < workload->treeCount; ++i) {
+    canonicalizePackedTree(workload->trees + i, classes);
+  }
+  stopCounters(counters);
+  addCounters(totals + phase_canonicalize, counters, workload->treeCount);
+
+  // The trees are canonical now, so this is the signature's cost on top of
+  // canonicalization.
+  startCounters(counters);
+  for (size_t i = 0; i < workload->treeCount; ++i) {
+    workload->hashes[i] = rankCanonicalTree(workload->trees[i], classes);
+  }
+  stopCounters(counters);
+  addCounters(totals + phase_hash, counters, workload->treeCount);
+
+  size_t solutions = 0;
+  for (size_t i = 0; i < workload->treeCount; ++i) {
+    if (workload->solved[i]) {
+      workload->solutions[solutions++] = workload->trees[i];
+    }
+  }
+  startCounters(counters);
+  for (size_t i = 0; i < solutions; ++i) {
+    printTemplated(sink, &workload->templates, workload->solutions[i],
+                   workload->numbers);
+  }
+  stopCounters(counters);
+  addCounters(totals + phase_print, counters, solutions);
+  enumerationChecksum ^= checksum;
+}
+
+static void printTotals(const struct PhaseTotals totals[phase_count],
+                        const struct Counters *counters, size_t puzzles) {
+  printf("%-13s %10s %12s", "phase", "items", "ns/puzzle");
+  for (int i = 0; i < counter_count; ++i) {
+    if (counters->fds[i] >= 0) {
+      printf(" %14s", counterNames[i]);
+    }
+  }
+  printf(" %10s\n", "ns/item");
+  for (int phase = 0; phase < phase_count; ++phase) {
+    const struct PhaseTotals *total = totals + phase;
+    const double items = total->items ? total->items : 1;
+    printf("%-13s %10" PRIu64 " %12.1f", phaseNames[phase], total->items,
+           (double)total->nanoseconds / puzzles);
+    for (int i = 0; i < counter_count; ++i) {
+      if (counters->fds[i] >= 0) {
+        printf(" %9.2f/item", total->values[i] / items);
+      }
+    }
+    printf(" %10.2f\n", total->nanoseconds / items);
+  }
+  if (counters->fds[counter_cycles] >= 0 &&
+      counters->fds[counter_instructions] >= 0) {
+    for (int phase = 0; phase < phase_count; ++phase) {
+      const struct PhaseTotals *total = totals + phase;
+      printf("%s IPC %.2f\n", phaseNames[phase],
+             total->values[counter_cycles]
+                 ? (double)total->values[counter_instructions] /
+                       total->values[counter_cycles]
+                 : 0.0);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int low = 1, high = 10;
+  if (argc == 3) {
+    if (parseSweepRange(argv[1], argv[2], &low, &high)) {
+      fprintf(stderr, "error: Invalid range %s to %s\n", argv[1], argv[2]);
+      return 1;
+    }
+  } else if (argc != 1) {
+    fprintf(stderr, "usage: %s [low high]\n", argv[0]);
+    return 1;
+  }
+  FILE *sink = fopen("/dev/null", "w");
+  if (!sink) {
+    fputs("error: Can't open /dev/null\n", stderr);
+    return 1;
+  }
+  struct Counters counters;
+  openCounters(&counters);
+  struct Workload *workload = xmalloc(sizeof(struct Workload));
+  initTemplateCache(&workload->templates, format_full);
+  struct PhaseTotals totals[phase_count];
+  memset(totals, 0, sizeof(totals));
+  const uint64_t puzzles = sweepSize(low, high);
+  for (uint64_t rank = 0; rank < puzzles; ++rank) {
+    unrankQuadruple(rank, low, high, workload->numbers);
+    measurePuzzle(workload, &counters, sink, totals);
+  }
+  printf("%" PRIu64 " puzzles with numbers from %d to %d\n", puzzles, low,
+         high);
+  printTotals(totals, &counters, puzzles);
+  free(workload);
+  closeCounters(&counters);
+  fclose(sink);
+  return 0;
+}
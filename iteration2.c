@@ -16,20 +16,55 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #ifdef __GNUC__
 #define NORETURN __attribute__((noreturn))
 #define CANT_REACH __builtin_unreachable();
+#define HAVE_ATOMICS
+#define ATOMIC_LOAD(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+#define ATOMIC_FETCH_ADD(ptr, val)                                             \
+  __atomic_fetch_add((ptr), (val), __ATOMIC_ACQ_REL)
+#define RELAXED_LOAD(ptr) __atomic_load_n((ptr), __ATOMIC_RELAXED)
+#define RELAXED_STORE(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELAXED)
+#define RELAXED_FETCH_ADD(ptr, val)                                            \
+  __atomic_fetch_add((ptr), (val), __ATOMIC_RELAXED)
+#define ATOMIC_COMPARE_EXCHANGE(ptr, expected, desired)                        \
+  __atomic_compare_exchange_n((ptr), (expected), (desired), false,             \
+                              __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)
+#define ACQUIRE_FENCE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define RELEASE_FENCE() __atomic_thread_fence(__ATOMIC_RELEASE)
 #else
 #define NORETURN
 #define CANT_REACH
+#define RELAXED_LOAD(ptr) (*(ptr))
+#define RELAXED_STORE(ptr, val) (*(ptr) = (val))
+#define RELAXED_FETCH_ADD(ptr, val) (*(ptr) += (val))
+#define ATOMIC_COMPARE_EXCHANGE(ptr, expected, desired)                        \
+  (*(ptr) == *(expected) ? (*(ptr) = (desired), true)                         \
+                         : (*(expected) = *(ptr), false))
+#define ACQUIRE_FENCE()
+#define RELEASE_FENCE()
 #endif
 
 static NORETURN void handleOutOfMemory() {
@@ -75,6 +110,82 @@ struct Node {
 };
 
 typedef struct Node SyntaxTree[all_count];
+
+// The packed representation stores a whole tree in a single word. Each node
+// occupies a slot of 9 bits: the lowest bit holds the NodeKind. Numbers store
+// the 2 bit index of their value in the puzzle's numbers, operators store
+// their 2 bit OperatorKind followed by the 3 bit indices of lhs and rhs.
+// The struct Node layout is only used at the API boundary.
+typedef uint64_t PackedTree;
+enum {
+  packed_slot_bits = 9,
+  packed_slot_mask = (1 << packed_slot_bits) - 1,
+  packed_index_mask = 7
+};
+
+static unsigned packedSlot(PackedTree tree, unsigned idx) {
+  return (tree >> (idx * packed_slot_bits)) & packed_slot_mask;
+}
+static void setPackedSlot(PackedTree *tree, unsigned idx, unsigned slot) {
+  const unsigned shift = idx * packed_slot_bits;
+  *tree = (*tree & ~((PackedTree)packed_slot_mask << shift)) |
+          (PackedTree)slot << shift;
+}
+
+static unsigned makePackedNumber(unsigned numberIdx) {
+  return node_number | numberIdx << 1;
+}
+static unsigned makePackedOperator(enum OperatorKind kind, unsigned lhs,
+                                   unsigned rhs) {
+  return node_operator | kind << 1 | lhs << 3 | rhs << 6;
+}
+static enum NodeKind slotKind(unsigned slot) { return slot & 1; }
+static unsigned slotNumber(unsigned slot) { return slot >> 1 & 3; }
+static enum OperatorKind slotOperator(unsigned slot) { return slot >> 1 & 3; }
+static unsigned slotLhs(unsigned slot) { return slot >> 3 & packed_index_mask; }
+static unsigned slotRhs(unsigned slot) { return slot >> 6 & packed_index_mask; }
+
+// Numbers are collected in memory order, so unpackTree restores the very same
+// tree from the result.
+static PackedTree packTree(const SyntaxTree tree, int numbers[number_count]) {
+  PackedTree packed = 0;
+  unsigned numberIdx = 0;
+  for (unsigned i = 0; i < all_count; ++i) {
+    switch (tree[i].kind) {
+    case node_number:
+      assert(numberIdx < number_count);
+      numbers[numberIdx] = tree[i].v.n;
+      setPackedSlot(&packed, i, makePackedNumber(numberIdx++));
+      break;
+    case node_operator:
+      setPackedSlot(&packed, i,
+                    makePackedOperator(tree[i].v.op.kind,
+                                       tree[i].v.op.lhs & packed_index_mask,
+                                       tree[i].v.op.rhs & packed_index_mask));
+      break;
+    }
+  }
+  return packed;
+}
+
+static void unpackTree(PackedTree packed, const int numbers[number_count],
+                       SyntaxTree tree) {
+  for (unsigned i = 0; i < all_count; ++i) {
+    const unsigned slot = packedSlot(packed, i);
+    switch (slotKind(slot)) {
+    case node_number:
+      tree[i] = (struct Node){.kind = node_number,
+                             .v = {.n = numbers[slotNumber(slot)]}};
+      break;
+    case node_operator:
+      tree[i] = (struct Node){
+          .kind = node_operator,
+          .v = {.op = {slotOperator(slot), slotLhs(slot), slotRhs(slot)}}};
+      break;
+    }
+  }
+}
+
 typedef struct {
   int num;
   bool valid;
@@ -87,18 +198,19 @@ static EvalResult makeInvalid() {
   return (EvalResult){.num = -1, .valid = false};
 }
 
-static EvalResult evalSyntaxTree(const SyntaxTree tree,
-                                 const struct Node *curNode) {
-  switch (curNode->kind) {
+static EvalResult evalPackedTree(PackedTree tree, const int numbers[],
+                                 unsigned idx) {
+  const unsigned slot = packedSlot(tree, idx);
+  switch (slotKind(slot)) {
   case node_number:
-    return makeNumber(curNode->v.n);
+    return makeNumber(numbers[slotNumber(slot)]);
   case node_operator: {
-    EvalResult lhs = evalSyntaxTree(tree, tree + curNode->v.op.lhs),
-               rhs = evalSyntaxTree(tree, tree + curNode->v.op.rhs);
+    EvalResult lhs = evalPackedTree(tree, numbers, slotLhs(slot)),
+               rhs = evalPackedTree(tree, numbers, slotRhs(slot));
     if (!lhs.valid || !rhs.valid) {
       return makeInvalid();
     }
-    switch (curNode->v.op.kind) {
+    switch (slotOperator(slot)) {
     case op_add:
       return makeNumber(lhs.num + rhs.num);
     case op_sub:
@@ -115,22 +227,43 @@ static EvalResult evalSyntaxTree(const SyntaxTree tree,
   CANT_REACH
 }
 
+// The SyntaxTree wrappers below are shims for the tests written against the
+// unpacked layout; the solver itself only works on packed trees.
+static inline EvalResult evalSyntaxTree(const SyntaxTree tree,
+                                        const struct Node *curNode) {
+  int numbers[number_count];
+  const PackedTree packed = packTree(tree, numbers);
+  return evalPackedTree(packed, numbers, curNode - tree);
+}
+
 static const char opChars[4] = {'+', '-', '*', '/'};
-static void printSyntaxTreeImpl(const SyntaxTree tree,
-                                const struct Node *curNode) {
-  switch (curNode->kind) {
+static void printPackedTreeImpl(FILE *out, PackedTree tree,
+                                const int numbers[], unsigned idx) {
+  const unsigned slot = packedSlot(tree, idx);
+  switch (slotKind(slot)) {
   case node_number:
-    printf("%d", curNode->v.n);
+    fprintf(out, "%d", numbers[slotNumber(slot)]);
     break;
   case node_operator:
-    putchar('(');
-    printSyntaxTreeImpl(tree, tree + curNode->v.op.lhs);
-    printf(" %c ", opChars[curNode->v.op.kind]);
-    printSyntaxTreeImpl(tree, tree + curNode->v.op.rhs);
-    putchar(')');
+    putc('(', out);
+    printPackedTreeImpl(out, tree, numbers, slotLhs(slot));
+    fprintf(out, " %c ", opChars[slotOperator(slot)]);
+    printPackedTreeImpl(out, tree, numbers, slotRhs(slot));
+    putc(')', out);
   }
 }
-static void printSyntaxTree(const SyntaxTree tree, const struct Node *curNode) {
+static void printPackedTree(FILE *out, PackedTree tree, const int numbers[]) {
+  printPackedTreeImpl(out, tree, numbers, all_count - 1);
+  putc('\n', out);
+}
+static void printSyntaxTreeImpl(const SyntaxTree tree,
+                                const struct Node *curNode) {
+  int numbers[number_count];
+  const PackedTree packed = packTree(tree, numbers);
+  printPackedTreeImpl(stdout, packed, numbers, curNode - tree);
+}
+static inline void printSyntaxTree(const SyntaxTree tree,
+                                   const struct Node *curNode) {
   printSyntaxTreeImpl(tree, curNode);
   putchar('\n');
 }
@@ -156,61 +289,205 @@ static void swap_impl(void *a, void *b, void *restrict c, size_t size) {
       (char[sizeof(*(a)) == sizeof(*(b)) ? (ptrdiff_t)sizeof(*(a)) : -1]){0},  \
       sizeof(*(a)))
 
-static int compareOps(const enum OperatorKind lhs[ops_count],
-                      const enum OperatorKind rhs[ops_count]) {
+// Trees are numbered in the order iteratePackedTrees visits them: operator
+// triples in the outer loop, then the operand choices of the first, second
+// and third operator. The last operator always takes the two remaining
+// operands. After each of the 12 choices of the first operator, 4 of the 6
+// choices of the second take the first result and leave 2 choices for the
+// third, while the other 2 combine two numbers and leave one. So every tree
+// of the 4 numbers in any order with any 3 operators is visited exactly
+// once: 5 shapes times 24 orders times 64 operator triples.
+enum {
+  operator_triples = 4 * 4 * 4,
+  wiring_count = 4 * 3 * (4 * 2 + 2 * 1),
+  tree_count = operator_triples * wiring_count
+};
+
+// Restricts the trees a search visits. Operators outside operators are never
+// used and every operator in required is used at least once. The depth of a
+// tree counts the operators on its longest path, and a left-deep tree
+// combines the previous result with a number at every operator after the
+// first.
+struct TreeConstraints {
+  unsigned char operators, required, maxDepth;
+  bool leftDeep;
+};
+
+static const struct TreeConstraints unconstrained = {
+    .operators = 0xf, .required = 0, .maxDepth = ops_count, .leftDeep = false};
+
+static bool allowsOperators(const struct TreeConstraints *constraints,
+                            const enum OperatorKind ops[ops_count]) {
+  unsigned used = 0;
   for (int i = 0; i < ops_count; ++i) {
-    if (lhs[i] != rhs[i]) {
-      return 0;
-    }
+    used |= 1u << ops[i];
   }
-  return 1;
+  return (used & ~constraints->operators) == 0 &&
+         (constraints->required & ~used) == 0;
 }
 
-static void iterateAllSyntaxTrees(const int numbers[4],
-                                  void (*callback)(const SyntaxTree tree,
-                                                   const struct Node *root,
-                                                   void *data),
-                                  void *data) {
-  SyntaxTree tree;
-  static const enum OperatorKind finalOps[ops_count] = {op_div, op_div, op_div};
+// The first operator always combines two numbers and ends up at position
+// first_rhs of the remaining operands. Unless the second operator takes it as
+// its lhs, it is then at the returned position, since taking the lhs moves
+// the operand at position 2 to second_lhs.
+static int firstResultPosition(int first_rhs, int second_lhs) {
+  return first_rhs == 2 ? second_lhs : first_rhs;
+}
+
+// Whether the second operator combines two numbers, so that the third
+// combines the results of the first two.
+static bool combinesResults(int first_rhs, int second_lhs, int second_rhs) {
+  return second_lhs != first_rhs &&
+         second_rhs != firstResultPosition(first_rhs, second_lhs);
+}
+
+// The tree has depth 3 exactly if the second operator takes the first
+// result, which has to be its lhs in a left-deep tree.
+static bool allowsSecondOperands(const struct TreeConstraints *constraints,
+                                 int first_rhs, int second_lhs,
+                                 int second_rhs) {
+  const bool lhsIsFirst = second_lhs == first_rhs;
+  if (constraints->leftDeep) {
+    return lhsIsFirst && constraints->maxDepth >= 3;
+  }
+  return constraints->maxDepth >=
+         (combinesResults(first_rhs, second_lhs, second_rhs) ? 2 : 3);
+}
+
+static void iterateConstrainedTrees(
+    const int numbers[4], const struct TreeConstraints *constraints,
+    void (*callback)(PackedTree tree, const int numbers[], void *data),
+    void *data) {
+  PackedTree leaves = 0;
+  for (unsigned i = 0; i < number_count; ++i) {
+    setPackedSlot(&leaves, i, makePackedNumber(i));
+  }
   enum OperatorKind ops[ops_count] = {op_add, op_add, op_add};
 
-  for (; !compareOps(ops, finalOps); incrementOperators(ops)) {
+  for (unsigned triple = 0; triple < operator_triples;
+       ++triple, incrementOperators(ops)) {
+    if (!allowsOperators(constraints, ops)) {
+      continue;
+    }
 #define FOR_VAR(name, top) for (int name = 0; name < top; ++name)
 #define FOR_OPERAND(name, top)                                                 \
   FOR_VAR(name##_lhs, top) FOR_VAR(name##_rhs, top - 1)
-    FOR_OPERAND(first, number_count)
-    FOR_OPERAND(second, number_count - 1) FOR_OPERAND(third, number_count - 2) {
-      // Setup the tree
-      for (int i = 0; i < number_count; ++i) {
-        tree[i] = (struct Node){.kind = node_number, {.n = numbers[i]}};
-      }
-      for (int i = 0; i < ops_count; ++i) {
-        tree[i + 4] =
-            (struct Node){.kind = node_operator, {.op = {ops[i], -1, -1}}};
-      }
-      char itab[all_count] = {0, 1, 2, 3, 4, 5, 6};
-      int arenaRight = number_count;
-      int curNode = number_count;
-      struct Node *curOperator = tree + number_count;
-      curOperator->v.op.lhs = itab[first_lhs];
-      swap(itab + first_lhs, itab + --arenaRight);
-      curOperator->v.op.rhs = itab[first_rhs];
-      swap(itab + first_rhs, itab + curNode++);
-      ++curOperator;
-      curOperator->v.op.lhs = itab[second_lhs];
-      swap(itab + second_lhs, itab + --arenaRight);
-      curOperator->v.op.rhs = itab[second_rhs];
-      swap(itab + second_rhs, itab + curNode++);
-      ++curOperator;
-      curOperator->v.op.lhs = itab[third_lhs];
-      swap(itab + third_lhs, itab + --arenaRight);
-      curOperator->v.op.rhs = itab[third_rhs];
-      swap(itab + third_rhs, itab + curNode++);
-      ++curOperator;
-      callback(tree, tree + all_count - 1, data);
+    FOR_OPERAND(first, number_count) FOR_OPERAND(second, number_count - 1) {
+      if (!allowsSecondOperands(constraints, first_rhs, second_lhs,
+                                second_rhs)) {
+        continue;
+      }
+      // The second operator ends up at position second_rhs. If it combined
+      // two numbers, both orders of the results build the same tree as
+      // another operator triple with the first two operators swapped, so
+      // only the one with the first result as the lhs is visited.
+      const int firstResult = firstResultPosition(first_rhs, second_lhs);
+      const bool bothResults =
+          combinesResults(first_rhs, second_lhs, second_rhs);
+      FOR_OPERAND(third, number_count - 2) {
+        if ((constraints->leftDeep && third_lhs != second_rhs) ||
+            (bothResults && third_lhs != firstResult)) {
+          continue;
+        }
+        PackedTree tree = leaves;
+        char itab[all_count] = {0, 1, 2, 3, 4, 5, 6};
+        int arenaRight = number_count;
+        int curNode = number_count;
+        unsigned lhs, rhs;
+        lhs = itab[first_lhs];
+        swap(itab + first_lhs, itab + --arenaRight);
+        rhs = itab[first_rhs];
+        swap(itab + first_rhs, itab + curNode++);
+        setPackedSlot(&tree, number_count,
+                      makePackedOperator(ops[0], lhs, rhs));
+        lhs = itab[second_lhs];
+        swap(itab + second_lhs, itab + --arenaRight);
+        rhs = itab[second_rhs];
+        swap(itab + second_rhs, itab + curNode++);
+        setPackedSlot(&tree, number_count + 1,
+                      makePackedOperator(ops[1], lhs, rhs));
+        lhs = itab[third_lhs];
+        swap(itab + third_lhs, itab + --arenaRight);
+        rhs = itab[third_rhs];
+        swap(itab + third_rhs, itab + curNode++);
+        setPackedSlot(&tree, number_count + 2,
+                      makePackedOperator(ops[2], lhs, rhs));
+        callback(tree, numbers, data);
+      }
+    }
+  }
+}
+
+// Visits every tree.
+static void iteratePackedTrees(const int numbers[4],
+                               void (*callback)(PackedTree tree,
+                                                const int numbers[],
+                                                void *data),
+                               void *data) {
+  iterateConstrainedTrees(numbers, &unconstrained, callback, data);
+}
+
+// Builds the tree with the given number.
+static PackedTree packedTreeAt(unsigned combination) {
+  assert(combination < tree_count);
+  const unsigned opBits = combination / wiring_count;
+  const unsigned wiring = combination % wiring_count;
+  const unsigned first_lhs = wiring / 30, first_rhs = wiring / 10 % 3;
+  unsigned choice = wiring % 10, second = 0;
+  for (;; ++second) {
+    const unsigned thirds =
+        combinesResults(first_rhs, second / 2, second % 2) ? 1 : 2;
+    if (choice < thirds) {
+      break;
     }
+    choice -= thirds;
+  }
+  const unsigned second_lhs = second / 2, second_rhs = second % 2;
+  const unsigned third_lhs =
+      combinesResults(first_rhs, second_lhs, second_rhs)
+          ? (unsigned)firstResultPosition(first_rhs, second_lhs)
+          : choice;
+  const unsigned lhsChoices[ops_count] = {first_lhs, second_lhs, third_lhs},
+                 rhsChoices[ops_count] = {first_rhs, second_rhs, 0};
+
+  PackedTree tree = 0;
+  for (unsigned i = 0; i < number_count; ++i) {
+    setPackedSlot(&tree, i, makePackedNumber(i));
+  }
+  char itab[all_count] = {0, 1, 2, 3, 4, 5, 6};
+  int arenaRight = number_count;
+  int curNode = number_count;
+  for (unsigned i = 0; i < ops_count; ++i) {
+    const unsigned lhs = itab[lhsChoices[i]];
+    swap(itab + lhsChoices[i], itab + --arenaRight);
+    const unsigned rhs = itab[rhsChoices[i]];
+    swap(itab + rhsChoices[i], itab + curNode++);
+    setPackedSlot(&tree, number_count + i,
+                  makePackedOperator(opBits >> (2 * i) & 3, lhs, rhs));
   }
+  return tree;
+}
+
+struct UnpackingIteration {
+  void (*callback)(const SyntaxTree tree, const struct Node *root, void *data);
+  void *data;
+};
+
+static void unpackingCallback(PackedTree tree, const int numbers[],
+                              void *data) {
+  const struct UnpackingIteration *iteration = data;
+  SyntaxTree unpacked;
+  unpackTree(tree, numbers, unpacked);
+  iteration->callback(unpacked, unpacked + all_count - 1, iteration->data);
+}
+
+static inline void
+iterateAllSyntaxTrees(const int numbers[4],
+                      void (*callback)(const SyntaxTree tree,
+                                       const struct Node *root, void *data),
+                      void *data) {
+  struct UnpackingIteration iteration = {.callback = callback, .data = data};
+  iteratePackedTrees(numbers, unpackingCallback, &iteration);
 }
 
 void debugPrintTree(const SyntaxTree tree) {
@@ -230,163 +507,225 @@ void debugPrintTree(const SyntaxTree tree) {
   putchar('\n');
 }
 
-struct CommutativeChunkState {
-  enum OperatorKind opKind;
-  unsigned char operandIndex;
-  unsigned char operatorIndex;
-  unsigned char operands[number_count];
-  unsigned char operators[ops_count];
-};
+// Addition and subtraction form chains in which only the sign of each
+// operand matters, e.g. a - (b - c) is a + c - b. Multiplication and
+// division do the same with reciprocals. Canonicalization collects every
+// maximal chain as a signed multiset of its operands and rebuilds it as
+//   (((p0 + p1) + ...) - n0) - ...
+// where the positive operands p and the negative operands n are each sorted
+// by their code, which spells out the whole operand including the values of
+// its numbers. Operands with equal codes are interchangeable, so equivalent
+// chains are rebuilt identically up to the placement of equal numbers. A
+// rebuilt division chain still divides exactly: when the product of the
+// numerators is a multiple of the product of the denominators, it is also a
+// multiple of every prefix of them.
+//
+// The trees produced by iteratePackedTrees and by rewriteTreeStructure store
+// every operator after its operands. So a single ascending pass over the
+// operators sees every subtree before its parent, and no recursion is needed.
 
-static unsigned char findCommutativeOperator(SyntaxTree tree,
-                                             unsigned char current);
-static unsigned char findAdjacentNodes(SyntaxTree tree, unsigned char current,
-                                       struct CommutativeChunkState *state);
+// op_add and op_sub form one group, op_mul and op_div the other. The first
+// kind of a group combines its operands, the second inverts its rhs.
+static unsigned operatorGroup(enum OperatorKind kind) { return kind >> 1; }
+static bool invertsRhs(enum OperatorKind kind) { return kind & 1; }
 
-static unsigned char maxOperand(const SyntaxTree tree, unsigned char idx) {
-  switch (tree[idx].kind) {
-  case node_number:
-    return idx;
-  case node_operator:
-#define MAX(a, b) ((a) > (b) ? (a) : (b))
-    return MAX(tree[idx].v.op.lhs, tree[idx].v.op.rhs) +
-           (tree[idx].v.op.kind << 4);
+// Numbers of equal value are interchangeable, so canonicalization only looks
+// at the class of a number: the first index holding its value.
+static void numberClasses(const int numbers[number_count],
+                          unsigned char classes[number_count]) {
+  for (unsigned char i = 0; i != number_count; ++i) {
+    classes[i] = 0;
+    while (numbers[classes[i]] != numbers[i]) {
+      ++classes[i];
+    }
   }
-  CANT_REACH;
 }
 
-static void canonicalizeMemoryRepr(SyntaxTree tree, struct Operator *op) {
-  struct Node *const lhs = tree + op->lhs, *const rhs = tree + op->rhs;
-  if (maxOperand(tree, op->lhs) > maxOperand(tree, op->rhs)) {
-    swap(lhs, rhs);
-    swap(&op->lhs, &op->rhs);
-  }
+// The code of a subtree is its preorder sequence: a 0 bit followed by the
+// class of a number, and a 1 bit followed by the OperatorKind for an
+// operator. A leading 1 bit marks the length, so comparing codes orders
+// smaller subtrees first. Subtrees with equal codes are equal up to the
+// placement of equal numbers.
+struct SubtreeCode {
+  uint32_t code;
+  unsigned char length;
+};
+
+static struct SubtreeCode numberCode(unsigned char numberClass) {
+  return (struct SubtreeCode){.code = 8u | numberClass, .length = 3};
 }
 
-static unsigned char
-analyzeCommutativeOperand(SyntaxTree tree, unsigned char nodeIdx,
-                          struct CommutativeChunkState *state) {
-  if (tree[nodeIdx].kind == node_number) {
-    state->operands[state->operandIndex++] = nodeIdx;
-    return nodeIdx;
-  } else if (tree[nodeIdx].v.op.kind == state->opKind) {
-    return findAdjacentNodes(tree, nodeIdx, state);
-  } else {
-    state->operands[state->operandIndex++] = nodeIdx;
-    assert(state->operandIndex <= number_count);
-    return findCommutativeOperator(tree, nodeIdx);
-  }
+static struct SubtreeCode combineCodes(enum OperatorKind kind,
+                                       struct SubtreeCode lhs,
+                                       struct SubtreeCode rhs) {
+  const unsigned length = 3 + lhs.length + rhs.length;
+  return (struct SubtreeCode){
+      .code = 1u << length | (4u | kind) << (lhs.length + rhs.length) |
+              (lhs.code ^ 1u << lhs.length) << rhs.length |
+              (rhs.code ^ 1u << rhs.length),
+      .length = length};
 }
 
-static unsigned char findAdjacentNodes(SyntaxTree tree, unsigned char current,
-                                       struct CommutativeChunkState *state) {
-  struct Operator *const op = &tree[current].v.op;
-  state->operators[state->operatorIndex++] = current;
-  op->lhs = analyzeCommutativeOperand(tree, op->lhs, state);
-  op->rhs = analyzeCommutativeOperand(tree, op->rhs, state);
-  return current;
+// Operands are sorted as a single word: whether they are inverted, their code
+// and finally their index in the tree. No operand has more than
+// number_count - 1 numbers, so its code fits.
+enum { operand_code_shift = 3, operand_inverted_shift = 19 };
+
+static uint32_t makeOperand(bool inverted, struct SubtreeCode code,
+                            unsigned char idx) {
+  assert(code.code < 1u << (operand_inverted_shift - operand_code_shift));
+  return (uint32_t)inverted << operand_inverted_shift |
+         code.code << operand_code_shift | idx;
 }
 
-static void sortUChar(unsigned char *first, unsigned char *last) {
-  bool sorted = false;
-  while (!sorted) {
-    sorted = true;
-    for (unsigned char *pos = first + 1; pos != last; ++pos) {
-      if (*pos < *(pos - 1)) {
-        swap(pos, pos - 1);
-        sorted = false;
-      }
+static void sortOperands(uint32_t *first, uint32_t *last) {
+  for (uint32_t *pos = first + 1; pos < last; ++pos) {
+    for (uint32_t *cur = pos; cur != first && *cur < cur[-1]; --cur) {
+      swap(cur, cur - 1);
     }
   }
 }
 
-static unsigned char
-rewriteCommutativeChain(SyntaxTree tree, struct CommutativeChunkState *state) {
-  sortUChar(state->operands, state->operands + state->operandIndex);
-  sortUChar(state->operators, state->operators + state->operatorIndex);
-  unsigned char *operand = state->operands, *const begin = state->operators,
-                *operator= begin;
-  const unsigned char firstLhsIdx = *operand++;
-  tree[*operator].v.op.lhs = firstLhsIdx;
-  const unsigned char firstRhsIdx = *operand++;
-  tree[*operator].v.op.rhs = firstRhsIdx;
-  if (maxOperand(tree, firstLhsIdx) > maxOperand(tree, firstRhsIdx)) {
-    swap(tree + firstLhsIdx, tree + firstRhsIdx);
-  }
-  ++operator;
-  for (unsigned char *const end = begin + state->operatorIndex; operator!= end;
-       ++operator) {
-    struct Operator *const op = &tree[*operator].v.op;
-    op->rhs = *(operator- 1);
-    op->lhs = *operand++;
-    canonicalizeMemoryRepr(tree, op);
-  }
-  assert(operand == state->operands + state->operandIndex);
-  return *(operator- 1);
-}
-
-static unsigned char findCommutativeOperator(SyntaxTree tree,
-                                             unsigned char current) {
-  if (tree[current].kind == node_number) {
-    return current;
-  }
-  const enum OperatorKind kind = tree[current].v.op.kind;
-  if (kind == op_add || kind == op_mul) {
-    struct CommutativeChunkState state = {.opKind = kind,
-                                          .operandIndex = 0,
-                                          .operatorIndex = 0,
-                                          .operands = {0},
-                                          .operators = {0}};
-    findAdjacentNodes(tree, current, &state);
-    return rewriteCommutativeChain(tree, &state);
-  } else {
-    struct Operator *const cur = &tree[current].v.op;
-    cur->lhs = findCommutativeOperator(tree, cur->lhs);
-    cur->rhs = findCommutativeOperator(tree, cur->rhs);
-    canonicalizeMemoryRepr(tree, cur);
-    return current;
+static void canonicalizeChains(PackedTree *tree,
+                               const unsigned char classes[number_count]) {
+  struct SubtreeCode codes[all_count];
+  unsigned chainMembers = 0;
+#define IS_CHAIN_MEMBER(idx) (chainMembers >> (idx) & 1)
+  for (unsigned char i = 0; i != number_count; ++i) {
+    assert(slotKind(packedSlot(*tree, i)) == node_number);
+    codes[i] = numberCode(classes[slotNumber(packedSlot(*tree, i))]);
+  }
+  for (unsigned char op = number_count; op != all_count; ++op) {
+    const unsigned slot = packedSlot(*tree, op);
+    const unsigned char children[2] = {slotLhs(slot), slotRhs(slot)};
+    assert(children[0] < op && children[1] < op);
+    for (int i = 0; i < 2; ++i) {
+      const unsigned childSlot = packedSlot(*tree, children[i]);
+      chainMembers |= (slotKind(childSlot) == node_operator &&
+                       operatorGroup(slotOperator(childSlot)) ==
+                           operatorGroup(slotOperator(slot)))
+                      << children[i];
+    }
   }
+
+  for (unsigned char op = number_count; op != all_count; ++op) {
+    if (IS_CHAIN_MEMBER(op)) {
+      continue;
+    }
+    const unsigned slot = packedSlot(*tree, op);
+    const enum OperatorKind kind = slotOperator(slot);
+    unsigned char lhs = slotLhs(slot), rhs = slotRhs(slot);
+    if (!IS_CHAIN_MEMBER(lhs) && !IS_CHAIN_MEMBER(rhs)) {
+      // A chain of a single operator only needs its operands ordered.
+      if (!invertsRhs(kind) && makeOperand(false, codes[rhs], rhs) <
+                                   makeOperand(false, codes[lhs], lhs)) {
+        swap(&lhs, &rhs);
+        setPackedSlot(tree, op, makePackedOperator(kind, lhs, rhs));
+      }
+      codes[op] = combineCodes(kind, codes[lhs], codes[rhs]);
+      continue;
+    }
+
+    // Collect the chain rooted at op. Pending operators carry whether they
+    // are inverted above their index.
+    uint32_t operands[number_count];
+    unsigned char operators[ops_count], pending[ops_count];
+    size_t operandCount = 0, operatorCount = 0, pendingSize = 0;
+    pending[pendingSize++] = op;
+    while (pendingSize > 0) {
+      const unsigned char current = pending[--pendingSize] & packed_index_mask;
+      const bool inverted = pending[pendingSize] >> 3;
+      operators[operatorCount++] = current;
+      const unsigned currentSlot = packedSlot(*tree, current);
+      const unsigned char children[2] = {slotLhs(currentSlot),
+                                         slotRhs(currentSlot)};
+      const bool childInverted[2] = {
+          inverted, inverted != invertsRhs(slotOperator(currentSlot))};
+      for (int i = 0; i < 2; ++i) {
+        const unsigned char child = children[i];
+        if (IS_CHAIN_MEMBER(child)) {
+          pending[pendingSize++] = childInverted[i] << 3 | child;
+        } else {
+          operands[operandCount++] =
+              makeOperand(childInverted[i], codes[child], child);
+        }
+      }
+    }
+    sortOperands(operands, operands + operandCount);
+    assert(operands[0] >> operand_inverted_shift == 0 &&
+           "The leftmost operand is never inverted");
+
+    // Rebuild the chain so that its root stays at op, which was collected
+    // first and is therefore assigned last.
+    const unsigned group = operatorGroup(kind);
+    unsigned char result = operands[0] & packed_index_mask;
+    for (size_t i = 1; i < operandCount; ++i) {
+      const unsigned char current = operators[operatorCount - i],
+                          operand = operands[i] & packed_index_mask;
+      const enum OperatorKind currentKind =
+          group << 1 | operands[i] >> operand_inverted_shift;
+      setPackedSlot(tree, current,
+                    makePackedOperator(currentKind, result, operand));
+      codes[current] =
+          combineCodes(currentKind, codes[result], codes[operand]);
+      result = current;
+    }
+    assert(operandCount == operatorCount + 1 && result == op);
+  }
+#undef IS_CHAIN_MEMBER
 }
 
-static unsigned char rewriteTreeStructureImpl(const SyntaxTree from,
-                                              unsigned char fromidx,
-                                              SyntaxTree to,
-                                              unsigned char *numidx,
-                                              unsigned char *opidx) {
-  unsigned char res;
-  switch (from[fromidx].kind) {
-  case node_number:
-    res = (*numidx)++;
-    to[res] = (struct Node){.kind = node_number, .v = {.n = from[fromidx].v.n}};
-    break;
-  case node_operator: {
-    const struct Operator *fop = &from[fromidx].v.op;
-    struct Operator op = {.kind = from[fromidx].v.op.kind};
-    res = (*opidx)--;
-    op.lhs = rewriteTreeStructureImpl(from, fop->lhs, to, numidx, opidx);
-    op.rhs = rewriteTreeStructureImpl(from, fop->rhs, to, numidx, opidx);
-    to[res] = (struct Node){.kind = node_operator, .v = {.op = op}};
+// Moves the nodes to the canonical layout, in which they are numbered in
+// preorder: numbers from 0 upwards and operators from all_count - 1
+// downwards.
+static void rewriteTreeStructure(PackedTree *from, unsigned char root) {
+  unsigned char canonicalIdx[all_count];
+  unsigned char stack[all_count];
+  size_t stackSize = 0;
+  unsigned char numIdx = 0, opIdx = all_count - 1;
+  stack[stackSize++] = root;
+  while (stackSize > 0) {
+    const unsigned char current = stack[--stackSize];
+    const unsigned slot = packedSlot(*from, current);
+    if (slotKind(slot) == node_number) {
+      canonicalIdx[current] = numIdx++;
+    } else {
+      canonicalIdx[current] = opIdx--;
+      stack[stackSize++] = slotRhs(slot);
+      stack[stackSize++] = slotLhs(slot);
+    }
   }
+  assert(numIdx == number_count);
+  assert(opIdx == all_count - ops_count - 1);
+
+  PackedTree to = 0;
+  for (unsigned char i = 0; i != all_count; ++i) {
+    const unsigned slot = packedSlot(*from, i);
+    setPackedSlot(&to, canonicalIdx[i],
+                  slotKind(slot) == node_number
+                      ? slot
+                      : makePackedOperator(slotOperator(slot),
+                                           canonicalIdx[slotLhs(slot)],
+                                           canonicalIdx[slotRhs(slot)]));
   }
-  return res;
+  *from = to;
 }
 
-static void rewriteTreeStructure(SyntaxTree from, unsigned char root) {
-  SyntaxTree to;
-  unsigned char numidx = 0;
-  unsigned char opidx = all_count - 1;
-  const unsigned char newRoot =
-      rewriteTreeStructureImpl(from, root, to, &numidx, &opidx);
-  assert(newRoot == all_count - 1);
-  assert(numidx == number_count);
-  assert(opidx == all_count - ops_count - 1);
-  memcpy(from, to, sizeof(SyntaxTree));
+static void canonicalizePackedTree(PackedTree *tree,
+                                   const unsigned char classes[number_count]) {
+  canonicalizeChains(tree, classes);
+  rewriteTreeStructure(tree, all_count - 1);
 }
 
-static void canonicalizeTree(SyntaxTree tree, struct Node *root) {
-  const unsigned char newRoot = findCommutativeOperator(tree, root - tree);
-  assert(tree + newRoot == root && "Root element doesn't change");
-  rewriteTreeStructure(tree, newRoot);
+static inline void canonicalizeTree(SyntaxTree tree, struct Node *root) {
+  assert(root == tree + all_count - 1);
+  (void)root;
+  int numbers[number_count];
+  PackedTree packed = packTree(tree, numbers);
+  unsigned char classes[number_count];
+  numberClasses(numbers, classes);
+  canonicalizePackedTree(&packed, classes);
+  unpackTree(packed, numbers, tree);
 }
 
 static unsigned char *findUChar(unsigned char *first, unsigned char *last,
@@ -397,9 +736,11 @@ static unsigned char *findUChar(unsigned char *first, unsigned char *last,
   return first;
 }
 
-static uint16_t hashTree(const SyntaxTree tree) {
-  static const unsigned char offsets[ops_count * 3] = {0,  6, 8,  2, 10,
-                                                       12, 4, 13, 14};
+static const unsigned char hashOffsets[ops_count * 3] = {0,  6, 8,  2, 10,
+                                                        12, 4, 13, 14};
+
+static uint16_t hashPackedTree(PackedTree tree) {
+  const unsigned char *const offsets = hashOffsets;
   const unsigned char *curOffset = offsets;
   uint16_t result = 0;
 #define PLACE_BITS(bits)                                                       \
@@ -408,17 +749,15 @@ static uint16_t hashTree(const SyntaxTree tree) {
   unsigned char itab[all_count] = {0, 1, 2, 3, 4, 5, 6};
   int arenaRight = number_count;
   int curNode = number_count;
-  for (const struct Node *curOperator = tree + number_count,
-                         *end = tree + all_count;
-       curOperator != end; ++curOperator) {
-    PLACE_BITS(curOperator->v.op.kind);
-    unsigned char *const lhs =
-        findUChar(itab, itab + all_count, curOperator->v.op.lhs);
+  for (unsigned curOperator = number_count; curOperator != all_count;
+       ++curOperator) {
+    const unsigned slot = packedSlot(tree, curOperator);
+    PLACE_BITS(slotOperator(slot));
+    unsigned char *const lhs = findUChar(itab, itab + all_count, slotLhs(slot));
     assert(lhs >= itab && lhs < itab + all_count);
     PLACE_BITS(lhs - itab);
     swap(lhs, itab + --arenaRight);
-    unsigned char *const rhs =
-        findUChar(itab, itab + all_count, curOperator->v.op.rhs);
+    unsigned char *const rhs = findUChar(itab, itab + all_count, slotRhs(slot));
     assert(rhs >= itab && rhs < itab + all_count);
     PLACE_BITS(rhs - itab);
     swap(rhs, itab + curNode++);
@@ -426,9 +765,510 @@ static uint16_t hashTree(const SyntaxTree tree) {
   return result;
 }
 
-struct SharedState {
-  uint16_t *seenTrees;
+static inline uint16_t hashTree(const SyntaxTree tree) {
+  int numbers[number_count];
+  return hashPackedTree(packTree(tree, numbers));
+}
+
+// The shapes of a tree, indexed by its preorder sequence with a set bit for
+// every operator and counted from 1.
+static const unsigned char treeShapes[1 << all_count] = {
+    [0x07] = 1, [0x0b] = 2, [0x0d] = 3, [0x13] = 4, [0x15] = 5};
+enum { arrangement_count = 4 * 3 * 2 * 1 };
+
+// Numbers the classes of canonical trees of a puzzle. After its chains are
+// canonicalized, a preorder walk finds the shape of the tree, its operators
+// and the order of its numbers. Equal numbers are taken in index order, so
+// the numbers form one of arrangement_count permutations, of which the
+// signature holds the rank. Equal signatures therefore mean equal canonical
+// trees, and canonicalizing the tree first doesn't change its signature.
+// rankCanonicalTree is the walk alone, for trees whose chains are already
+// canonical.
+static uint16_t rankCanonicalTree(PackedTree tree,
+                                  const unsigned char classes[number_count]) {
+  unsigned char stack[all_count];
+  size_t stackSize = 0;
+  unsigned shape = 0, position = 0, ops = 0, arrangement = 0, unused = 0xf,
+           placed = 0;
+  stack[stackSize++] = all_count - 1;
+  while (stackSize > 0) {
+    const unsigned slot = packedSlot(tree, stack[--stackSize]);
+    if (slotKind(slot) == node_operator) {
+      shape |= 1u << position;
+      ops = ops << 2 | slotOperator(slot);
+      stack[stackSize++] = slotRhs(slot);
+      stack[stackSize++] = slotLhs(slot);
+    } else {
+      const unsigned char numberClass = classes[slotNumber(slot)];
+      unsigned idx = numberClass;
+      while (!(unused >> idx & 1) || classes[idx] != numberClass) {
+        ++idx;
+      }
+      unused &= ~(1u << idx);
+      arrangement *= number_count - placed++;
+      for (unsigned smaller = 0; smaller < idx; ++smaller) {
+        arrangement += unused >> smaller & 1;
+      }
+    }
+    ++position;
+  }
+  assert(treeShapes[shape] != 0);
+  return ((treeShapes[shape] - 1) * operator_triples + ops) *
+             arrangement_count +
+         arrangement;
+}
+
+static uint16_t canonicalSignature(PackedTree tree,
+                                   const unsigned char classes[number_count]) {
+  canonicalizeChains(&tree, classes);
+  return rankCanonicalTree(tree, classes);
+}
+
+// No puzzle has more canonical solutions than there are distinct canonical
+// signatures over all trees, which tests/canonicalSignature.c checks.
+enum {
+  target_number = 24,
+  max_near_misses = 32,
+  max_canonical_solutions = 1260
+};
+
+struct NearMiss {
+  PackedTree tree;
+  int value;
+  unsigned distance;
+  uint16_t hash;
+};
+
+// A max-heap on the distance to the target, so the worst near miss can be
+// replaced in O(log k) once the heap is full.
+struct NearMissHeap {
   size_t size, capacity;
+  struct NearMiss entries[max_near_misses];
+};
+
+// Solutions can be printed fully parenthesized, with only the parentheses
+// precedence and associativity require, or in reverse Polish notation.
+// Rendering a tree depends only on its structure, so each structure is
+// compiled once into a template: the literal text between its numbers and
+// the slots of those numbers. Printing a solution then copies the literals
+// and formats the numbers into one line.
+enum OutputFormat { format_full, format_minimal, format_rpn, format_count };
+static const char *const formatNames[format_count] = {"full", "minimal",
+                                                      "rpn"};
+
+enum {
+  // The fully parenthesized format is the longest, with "(", " + " and ")"
+  // for every operator.
+  template_literal_size = ops_count * 5,
+  template_cache_bits = 8,
+  template_cache_size = 1 << template_cache_bits,
+  // A line holds the literals, four formatted ints and a newline.
+  template_line_size = template_literal_size + number_count * 11 + 1
+};
+
+struct OutputTemplate {
+  // The tree with the number indices cleared. Every tree has an operator
+  // slot, so a zeroed template matches nothing.
+  PackedTree key;
+  unsigned char slots[number_count];
+  // Literal i precedes number i, the last one follows the last number.
+  unsigned char lengths[number_count + 1];
+  char literals[template_literal_size];
+};
+
+struct TemplateCache {
+  enum OutputFormat format;
+  struct OutputTemplate entries[template_cache_size];
+};
+
+static void initTemplateCache(struct TemplateCache *cache,
+                              enum OutputFormat format) {
+  memset(cache, 0, sizeof(*cache));
+  cache->format = format;
+}
+
+static PackedTree templateKey(PackedTree tree) {
+  for (unsigned i = 0; i < all_count; ++i) {
+    const unsigned slot = packedSlot(tree, i);
+    if (slotKind(slot) == node_number) {
+      setPackedSlot(&tree, i, makePackedNumber(0));
+    }
+  }
+  return tree;
+}
+
+struct TemplateBuilder {
+  struct OutputTemplate *compiled;
+  unsigned numberCount, literalSize, literalStart;
+};
+
+static void appendLiteral(struct TemplateBuilder *builder, const char *text) {
+  const size_t length = strlen(text);
+  assert(builder->literalSize + length <= template_literal_size);
+  memcpy(builder->compiled->literals + builder->literalSize, text, length);
+  builder->literalSize += length;
+}
+
+static void appendNumberSlot(struct TemplateBuilder *builder, unsigned idx) {
+  struct OutputTemplate *compiled = builder->compiled;
+  compiled->lengths[builder->numberCount] =
+      builder->literalSize - builder->literalStart;
+  compiled->slots[builder->numberCount++] = idx;
+  builder->literalStart = builder->literalSize;
+}
+
+// Renders slot idx, which the parent needs parenthesized if parenthesize.
+static void compileTemplateNode(struct TemplateBuilder *builder,
+                                PackedTree tree, enum OutputFormat format,
+                                unsigned idx, bool parenthesize) {
+  const unsigned slot = packedSlot(tree, idx);
+  if (slotKind(slot) == node_number) {
+    appendNumberSlot(builder, idx);
+    return;
+  }
+  const enum OperatorKind kind = slotOperator(slot);
+  const char op[] = {' ', opChars[kind], ' ', '\0'};
+  if (format == format_rpn) {
+    compileTemplateNode(builder, tree, format, slotLhs(slot), false);
+    appendLiteral(builder, " ");
+    compileTemplateNode(builder, tree, format, slotRhs(slot), false);
+    appendLiteral(builder, (const char[]){' ', opChars[kind], '\0'});
+    return;
+  }
+  bool lhsParens = true, rhsParens = true;
+  if (format == format_minimal) {
+    // The operator groups are also the precedence levels. Operators of the
+    // same precedence associate to the left, and only subtraction and
+    // division change their rhs.
+    const unsigned lhsSlot = packedSlot(tree, slotLhs(slot)),
+                   rhsSlot = packedSlot(tree, slotRhs(slot));
+    lhsParens = slotKind(lhsSlot) == node_operator &&
+                operatorGroup(slotOperator(lhsSlot)) <
+                    operatorGroup(kind);
+    rhsParens = slotKind(rhsSlot) == node_operator &&
+                (operatorGroup(slotOperator(rhsSlot)) <
+                     operatorGroup(kind) ||
+                 (operatorGroup(slotOperator(rhsSlot)) ==
+                      operatorGroup(kind) &&
+                  (kind == op_sub || kind == op_div)));
+  }
+  if (parenthesize) {
+    appendLiteral(builder, "(");
+  }
+  compileTemplateNode(builder, tree, format, slotLhs(slot), lhsParens);
+  appendLiteral(builder, op);
+  compileTemplateNode(builder, tree, format, slotRhs(slot), rhsParens);
+  if (parenthesize) {
+    appendLiteral(builder, ")");
+  }
+}
+
+static const struct OutputTemplate *findTemplate(struct TemplateCache *cache,
+                                                 PackedTree tree) {
+  const PackedTree key = templateKey(tree);
+  struct OutputTemplate *compiled =
+      cache->entries +
+      (key * UINT64_C(0x9e3779b97f4a7c15) >> (64 - template_cache_bits));
+  if (compiled->key == key) {
+    return compiled;
+  }
+  compiled->key = key;
+  struct TemplateBuilder builder = {.compiled = compiled,
+                                    .numberCount = 0,
+                                    .literalSize = 0,
+                                    .literalStart = 0};
+  compileTemplateNode(&builder, tree, cache->format, all_count - 1,
+                      cache->format == format_full);
+  compiled->lengths[number_count] = builder.literalSize - builder.literalStart;
+  return compiled;
+}
+
+// Formats number at the end of a buffer and returns where it starts.
+static char *formatInt(int number, char *end) {
+  unsigned magnitude = number < 0 ? -(unsigned)number : (unsigned)number;
+  do {
+    *--end = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude != 0);
+  if (number < 0) {
+    *--end = '-';
+  }
+  return end;
+}
+
+// Renders the tree into line, which has template_line_size bytes, without a
+// newline. Returns the length.
+static size_t renderTree(struct TemplateCache *cache, PackedTree tree,
+                         const int numbers[], char *line) {
+  const struct OutputTemplate *compiled = findTemplate(cache, tree);
+  const char *literal = compiled->literals;
+  size_t size = 0;
+  for (unsigned i = 0; i < number_count; ++i) {
+    memcpy(line + size, literal, compiled->lengths[i]);
+    size += compiled->lengths[i];
+    literal += compiled->lengths[i];
+    char digits[11], *const end = digits + sizeof(digits);
+    const char *first = formatInt(
+        numbers[slotNumber(packedSlot(tree, compiled->slots[i]))], end);
+    memcpy(line + size, first, end - first);
+    size += end - first;
+  }
+  memcpy(line + size, literal, compiled->lengths[number_count]);
+  return size + compiled->lengths[number_count];
+}
+
+static void printTemplated(FILE *out, struct TemplateCache *cache,
+                           PackedTree tree, const int numbers[]) {
+  char line[template_line_size];
+  const size_t size = renderTree(cache, tree, numbers, line);
+  line[size] = '\n';
+  fwrite(line, 1, size + 1, out);
+}
+
+// A trace records the decisions of the solver for offline analysis: every
+// puzzle, whether the reachable cache skipped it, and for every visited tree
+// its value and whether it is valid. Solutions also record their canonical
+// signature and whether they duplicate an earlier one. Events are fixed-size
+// binary records. Each solver thread appends them to its own ring of blocks
+// and hands full blocks over to a writer thread, so solving only waits when
+// the writer falls a whole ring behind. The file is a header followed by the
+// blocks in the order they were written, each tagged with the thread that
+// recorded it. Trees are stored packed, so the decoder rebuilds them from
+// the numbers of the puzzle they belong to.
+enum TraceEventKind { trace_puzzle, trace_skipped, trace_tree };
+enum TraceFlag { trace_valid = 1, trace_solution = 2, trace_duplicate = 4 };
+enum {
+  trace_format_version = 1,
+  trace_block_events = 1 << 12,
+  trace_ring_blocks = 4,
+  max_trace_threads = 1024
+};
+
+// A puzzle takes two trace_puzzle events, holding two numbers each in tree.
+// The first has value 0 and the second value 1.
+struct TraceEvent {
+  PackedTree tree;
+  int32_t value;
+  uint16_t hash;
+  uint8_t kind, flags;
+};
+
+struct TraceFileHeader {
+  char magic[12];
+  uint32_t version, eventSize;
+};
+
+struct TraceBlockHeader {
+  uint32_t thread, count;
+};
+
+static const char traceMagic[12] = "game24-trace";
+
+struct TraceWriter;
+
+// Blocks are handed over and written in the order they fill. Ring slot
+// handedOver % trace_ring_blocks is the one being filled.
+struct TraceRecorder {
+  struct TraceEvent *next, *end;
+  struct TraceEvent *blocks;
+  uint32_t counts[trace_ring_blocks];
+  size_t handedOver, written;
+  uint32_t thread;
+  struct TraceWriter *writer;
+};
+
+struct TraceWriter {
+  FILE *out;
+  const char *path;
+  struct TraceRecorder *recorders;
+  unsigned recorderCount, nextRecorder;
+  bool done, failed;
+#ifdef HAVE_ATOMICS
+  pthread_t thread;
+#endif
+};
+
+#ifdef HAVE_ATOMICS
+static void backoff(unsigned *spins) {
+  if (++*spins < 64) {
+    return;
+  } else if (*spins < 1024) {
+    sched_yield();
+  } else {
+    nanosleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 50000}, NULL);
+  }
+}
+#endif
+
+static void writeTraceBlock(struct TraceWriter *writer,
+                            const struct TraceRecorder *recorder,
+                            size_t block) {
+  const size_t slot = block % trace_ring_blocks;
+  const struct TraceBlockHeader header = {.thread = recorder->thread,
+                                          .count = recorder->counts[slot]};
+  if (fwrite(&header, sizeof(header), 1, writer->out) != 1 ||
+      fwrite(recorder->blocks + slot * trace_block_events,
+             sizeof(struct TraceEvent), header.count,
+             writer->out) != header.count) {
+    writer->failed = true;
+  }
+}
+
+// Ends the block being filled and starts the next one once its slot of the
+// ring is written.
+static void handOverTraceBlock(struct TraceRecorder *recorder) {
+  const size_t slot = recorder->handedOver % trace_ring_blocks;
+  struct TraceEvent *const block = recorder->blocks + slot * trace_block_events;
+  recorder->counts[slot] = recorder->next - block;
+#ifdef HAVE_ATOMICS
+  ATOMIC_STORE(&recorder->handedOver, recorder->handedOver + 1);
+  unsigned spins = 0;
+  while (recorder->handedOver - ATOMIC_LOAD(&recorder->written) >=
+         trace_ring_blocks) {
+    backoff(&spins);
+  }
+#else
+  writeTraceBlock(recorder->writer, recorder, recorder->handedOver++);
+  ++recorder->written;
+#endif
+  recorder->next = recorder->blocks + recorder->handedOver %
+                                          trace_ring_blocks *
+                                          trace_block_events;
+  recorder->end = recorder->next + trace_block_events;
+}
+
+static void recordTraceEvent(struct TraceRecorder *recorder,
+                             struct TraceEvent event) {
+  if (recorder->next == recorder->end) {
+    handOverTraceBlock(recorder);
+  }
+  *recorder->next++ = event;
+}
+
+static void tracePuzzle(struct TraceRecorder *recorder,
+                        const int numbers[number_count]) {
+  for (unsigned i = 0; i < number_count; i += 2) {
+    recordTraceEvent(
+        recorder,
+        (struct TraceEvent){.tree = (uint32_t)numbers[i] |
+                                    (PackedTree)(uint32_t)numbers[i + 1]
+                                        << 32,
+                            .value = i / 2,
+                            .hash = 0,
+                            .kind = trace_puzzle,
+                            .flags = 0});
+  }
+}
+
+#ifdef HAVE_ATOMICS
+// Writes the blocks the recorders hand over until the writer is closed and
+// nothing is left.
+static void *traceWriterThread(void *data) {
+  struct TraceWriter *writer = data;
+  unsigned spins = 0;
+  for (;;) {
+    const bool done = ATOMIC_LOAD(&writer->done);
+    bool progress = false;
+    for (unsigned i = 0; i < writer->recorderCount; ++i) {
+      struct TraceRecorder *recorder = writer->recorders + i;
+      while (recorder->written != ATOMIC_LOAD(&recorder->handedOver)) {
+        writeTraceBlock(writer, recorder, recorder->written);
+        ATOMIC_STORE(&recorder->written, recorder->written + 1);
+        progress = true;
+      }
+    }
+    if (done && !progress) {
+      return NULL;
+    }
+    if (progress) {
+      spins = 0;
+    } else {
+      backoff(&spins);
+    }
+  }
+}
+#endif
+
+static int openTraceWriter(struct TraceWriter *writer, const char *path,
+                           unsigned recorderCount) {
+  writer->out = fopen(path, "wb");
+  if (!writer->out) {
+    fprintf(stderr, "error: Can't open trace %s\n", path);
+    return 1;
+  }
+  writer->path = path;
+  writer->recorderCount = recorderCount;
+  writer->nextRecorder = 0;
+  writer->done = false;
+  struct TraceFileHeader header = {.version = trace_format_version,
+                                   .eventSize = sizeof(struct TraceEvent)};
+  memcpy(header.magic, traceMagic, sizeof(header.magic));
+  writer->failed = fwrite(&header, sizeof(header), 1, writer->out) != 1;
+  writer->recorders = xmalloc(sizeof(struct TraceRecorder) * recorderCount);
+  for (unsigned i = 0; i < recorderCount; ++i) {
+    struct TraceRecorder *recorder = writer->recorders + i;
+    recorder->blocks = xmalloc(sizeof(struct TraceEvent) * trace_ring_blocks *
+                               trace_block_events);
+    recorder->next = recorder->blocks;
+    recorder->end = recorder->blocks + trace_block_events;
+    recorder->handedOver = recorder->written = 0;
+    recorder->thread = i;
+    recorder->writer = writer;
+  }
+#ifdef HAVE_ATOMICS
+  pthread_create(&writer->thread, NULL, traceWriterThread, writer);
+#endif
+  return 0;
+}
+
+// Gives every solver thread a recorder of its own.
+static struct TraceRecorder *claimTraceRecorder(struct TraceWriter *writer) {
+  const unsigned idx = RELAXED_FETCH_ADD(&writer->nextRecorder, 1);
+  assert(idx < writer->recorderCount);
+  return writer->recorders + idx;
+}
+
+// Writes what is left once no solver records anymore.
+static int closeTraceWriter(struct TraceWriter *writer) {
+  for (unsigned i = 0; i < writer->recorderCount; ++i) {
+    struct TraceRecorder *recorder = writer->recorders + i;
+    const size_t slot = recorder->handedOver % trace_ring_blocks;
+    if (recorder->next != recorder->blocks + slot * trace_block_events) {
+      handOverTraceBlock(recorder);
+    }
+  }
+#ifdef HAVE_ATOMICS
+  ATOMIC_STORE(&writer->done, true);
+  pthread_join(writer->thread, NULL);
+#endif
+  const bool failed = writer->failed;
+  const int ret = fclose(writer->out) != 0 || failed;
+  for (unsigned i = 0; i < writer->recorderCount; ++i) {
+    free(writer->recorders[i].blocks);
+  }
+  free(writer->recorders);
+  if (ret) {
+    fprintf(stderr, "error: Can't write trace %s\n", writer->path);
+  }
+  return ret;
+}
+
+// The state a solver reuses across puzzles. The seen signatures are stored
+// inline, so solving never allocates and resetting is O(1). highWater records
+// the most solutions any puzzle solved with this state has had.
+struct SharedState {
+  uint16_t seenTrees[max_canonical_solutions];
+  size_t size, highWater;
+  struct NearMissHeap *nearMisses;
+  struct LatencyRecorder *latency;
+  struct ReachableCache *reachable;
+  struct TraceRecorder *trace;
+  struct DifficultyFeatures *features;
+  // Solutions are printed as found rather than canonicalized when the trees
+  // are constrained, since the canonical form may break the constraints.
+  const struct TreeConstraints *constraints;
+  struct TemplateCache templates;
+  FILE *out;
 };
 
 static uint16_t *upperBound(uint16_t *first, uint16_t *last, uint16_t hash) {
@@ -447,60 +1287,3678 @@ static uint16_t *upperBound(uint16_t *first, uint16_t *last, uint16_t hash) {
 }
 
 static void insert(uint16_t hash, uint16_t *pos, struct SharedState *state) {
-  if (state->size == state->capacity) {
-    state->capacity *= 2;
-    const size_t offset = pos - state->seenTrees;
-    state->seenTrees =
-        xrealloc(state->seenTrees, sizeof(uint16_t) * state->capacity);
-    pos = state->seenTrees + offset;
-  }
+  assert(state->size < max_canonical_solutions);
   const size_t movesize = (state->seenTrees + state->size) - pos;
   memmove(pos + 1, pos, movesize * sizeof(uint16_t));
   *pos = hash;
-  ++state->size;
-}
-
-static void checkAndPrintCallback(const SyntaxTree tree,
-                                  const struct Node *root, void *data) {
-  const EvalResult res = evalSyntaxTree(tree, root);
-  if (res.valid && res.num == 24) {
-    SyntaxTree copy;
-    memcpy(&copy, tree, sizeof(copy));
-    struct Node *const rootCopy = copy + all_count - 1;
-    canonicalizeTree(copy, rootCopy);
-    const uint16_t hash = hashTree(copy);
-    struct SharedState *state = data;
-    uint16_t *end = state->seenTrees + state->size,
-             *pos = upperBound(state->seenTrees, end, hash);
-    if (pos == end || *pos != hash) {
-#ifdef DEBUG_PRINT
-      printf("-------------------------\n");
-      debugPrintTree(tree);
-      debugPrintTree(copy);
-      printf("Found hash %d\n", (int)hash);
-#endif
-      printSyntaxTree(copy, rootCopy);
-      insert(hash, pos, state);
-    }
+  if (++state->size > state->highWater) {
+    state->highWater = state->size;
   }
 }
 
-static void sortInt(int *first, int *last) {
-  bool sorted = false;
-  while (!sorted) {
-    sorted = true;
-    for (int *pos = first + 1; pos != last; ++pos) {
-      if (*pos < *(pos - 1)) {
-        swap(pos, pos - 1);
-        sorted = false;
-      }
+static bool nearMissIsWorse(const struct NearMiss *lhs,
+                            const struct NearMiss *rhs) {
+  return lhs->distance > rhs->distance ||
+         (lhs->distance == rhs->distance && lhs->hash > rhs->hash);
+}
+
+static void siftDownNearMiss(struct NearMissHeap *heap, size_t idx,
+                             size_t size) {
+  for (;;) {
+    size_t worst = idx;
+    const size_t lhs = 2 * idx + 1, rhs = 2 * idx + 2;
+    if (lhs < size &&
+        nearMissIsWorse(heap->entries + lhs, heap->entries + worst)) {
+      worst = lhs;
+    }
+    if (rhs < size &&
+        nearMissIsWorse(heap->entries + rhs, heap->entries + worst)) {
+      worst = rhs;
+    }
+    if (worst == idx) {
+      return;
     }
+    swap(heap->entries + idx, heap->entries + worst);
+    idx = worst;
   }
 }
 
-enum { initial_cache_size = 32 };
+static void siftUpNearMiss(struct NearMissHeap *heap, size_t idx) {
+  while (idx > 0) {
+    const size_t parent = (idx - 1) / 2;
+    if (!nearMissIsWorse(heap->entries + idx, heap->entries + parent)) {
+      return;
+    }
+    swap(heap->entries + idx, heap->entries + parent);
+    idx = parent;
+  }
+}
+
+static void recordNearMiss(struct NearMissHeap *heap, PackedTree tree,
+                           const int numbers[number_count], int value) {
+  const unsigned distance = value > target_number
+                                ? (unsigned)value - target_number
+                                : (unsigned)(target_number - value);
+  const bool full = heap->size == heap->capacity;
+  // Cheap rejection first: most trees are farther away than the worst entry
+  // and never have to be canonicalized.
+  if (full && distance >= heap->entries[0].distance) {
+    return;
+  }
+  unsigned char classes[number_count];
+  numberClasses(numbers, classes);
+  struct NearMiss candidate = {.tree = tree,
+                               .value = value,
+                               .distance = distance,
+                               .hash = canonicalSignature(tree, classes)};
+  for (const struct NearMiss *cur = heap->entries,
+                             *end = heap->entries + heap->size;
+       cur != end; ++cur) {
+    if (cur->hash == candidate.hash) {
+      return;
+    }
+  }
+  canonicalizePackedTree(&candidate.tree, classes);
+  if (full) {
+    heap->entries[0] = candidate;
+    siftDownNearMiss(heap, 0, heap->size);
+  } else {
+    heap->entries[heap->size] = candidate;
+    siftUpNearMiss(heap, heap->size++);
+  }
+}
+
+// Sorts the heap in place by ascending distance. The heap property is lost.
+static void sortNearMisses(struct NearMissHeap *heap) {
+  for (size_t end = heap->size; end > 1; --end) {
+    swap(heap->entries, heap->entries + end - 1);
+    siftDownNearMiss(heap, 0, end - 1);
+  }
+}
+
+static void printNearMisses(FILE *out, struct NearMissHeap *heap,
+                            struct TemplateCache *templates,
+                            const int numbers[]) {
+  sortNearMisses(heap);
+  for (const struct NearMiss *cur = heap->entries,
+                             *end = heap->entries + heap->size;
+       cur != end; ++cur) {
+    char line[template_line_size];
+    const size_t size = renderTree(templates, cur->tree, numbers, line);
+    fwrite(line, 1, size, out);
+    fprintf(out, " = %d\n", cur->value);
+  }
+}
+
+static unsigned char usedOperators(PackedTree tree) {
+  unsigned char used = 0;
+  for (unsigned i = number_count; i < all_count; ++i) {
+    used |= 1u << slotOperator(packedSlot(tree, i));
+  }
+  return used;
+}
+
+// Difficulty features of a puzzle, accumulated by the pass that solves it
+// in fixed-size fields. required holds the operators every canonical
+// solution uses, minDepth the smallest depth of a tree reaching the target
+// and tripleHits how many trees of each operator triple do, indexed like the
+// operator bits of packedTreeAt. A puzzle needs fractions if no tree reaches
+// the target in integers but one does with exact fractions. That is only
+// asked of puzzles without solutions, which the real-valued kernel answers
+// for all trees at once, so the integer pass does no extra work for it.
+struct DifficultyFeatures {
+  unsigned char required, minDepth;
+  bool fractional;
+  unsigned char tripleHits[operator_triples];
+};
+
+static bool needsFractions(const int numbers[number_count]);
+
+static void resetFeatures(struct DifficultyFeatures *features) {
+  features->required = 0xf;
+  features->minDepth = ops_count;
+  features->fractional = false;
+  memset(features->tripleHits, 0, sizeof(features->tripleHits));
+}
+
+// Counts a tree that reaches the target. The first operator always combines
+// two numbers, so a tree has depth 3 if the second takes its result and
+// depth 2 otherwise.
+static void recordSolutionFeatures(struct DifficultyFeatures *features,
+                                   PackedTree tree) {
+  const unsigned second = packedSlot(tree, number_count + 1);
+  const unsigned char depth =
+      slotLhs(second) == number_count || slotRhs(second) == number_count ? 3
+                                                                         : 2;
+  if (depth < features->minDepth) {
+    features->minDepth = depth;
+  }
+  unsigned triple = 0;
+  for (unsigned i = 0; i < ops_count; ++i) {
+    triple |= slotOperator(packedSlot(tree, number_count + i)) << (2 * i);
+  }
+  ++features->tripleHits[triple];
+}
+
+static void printFeatures(FILE *out, const struct DifficultyFeatures *features,
+                          size_t solutions) {
+  fprintf(out, "features solutions %lu required ", (unsigned long)solutions);
+  const unsigned char required = solutions ? features->required : 0;
+  for (unsigned kind = op_add; kind <= op_div; ++kind) {
+    if (required >> kind & 1) {
+      putc(opChars[kind], out);
+    }
+  }
+  fprintf(out, "%s depth %u fractional %s triples", required ? "" : "none",
+          solutions ? (unsigned)features->minDepth : 0u,
+          features->fractional ? "yes" : "no");
+  bool any = false;
+  for (unsigned triple = 0; triple < operator_triples; ++triple) {
+    if (features->tripleHits[triple]) {
+      fprintf(out, "%s%c%c%c:%u", any ? "," : " ", opChars[triple & 3],
+              opChars[triple >> 2 & 3], opChars[triple >> 4],
+              (unsigned)features->tripleHits[triple]);
+      any = true;
+    }
+  }
+  fputs(any ? "\n" : " none\n", out);
+}
+
+static void checkAndPrintCallback(PackedTree tree, const int numbers[],
+                                  void *data) {
+  const EvalResult res = evalPackedTree(tree, numbers, all_count - 1);
+  struct SharedState *state = data;
+  if (state->trace && (!res.valid || res.num != target_number)) {
+    recordTraceEvent(state->trace,
+                     (struct TraceEvent){.tree = tree,
+                                         .value = res.num,
+                                         .hash = 0,
+                                         .kind = trace_tree,
+                                         .flags = res.valid ? trace_valid : 0});
+  }
+  if (!res.valid) {
+    return;
+  }
+  if (res.num != target_number) {
+    // Once an exact solution is known near misses are never printed.
+    if (state->nearMisses && state->size == 0) {
+      recordNearMiss(state->nearMisses, tree, numbers, res.num);
+    }
+    return;
+  }
+  unsigned char classes[number_count];
+  numberClasses(numbers, classes);
+  const uint16_t hash = canonicalSignature(tree, classes);
+  uint16_t *end = state->seenTrees + state->size,
+           *pos = upperBound(state->seenTrees, end, hash);
+  const bool duplicate = pos != end && *pos == hash;
+  if (state->trace) {
+    recordTraceEvent(
+        state->trace,
+        (struct TraceEvent){
+            .tree = tree,
+            .value = res.num,
+            .hash = hash,
+            .kind = trace_tree,
+            .flags = trace_valid | trace_solution |
+                     (duplicate ? trace_duplicate : 0)});
+  }
+  if (state->features) {
+    recordSolutionFeatures(state->features, tree);
+  }
+  if (!duplicate) {
+    PackedTree copy = tree;
+    if (!state->constraints) {
+      canonicalizePackedTree(&copy, classes);
+    }
+    if (state->features) {
+      state->features->required &= usedOperators(copy);
+    }
+#ifdef DEBUG_PRINT
+    printf("-------------------------\n");
+    SyntaxTree unpacked;
+    unpackTree(tree, numbers, unpacked);
+    debugPrintTree(unpacked);
+    unpackTree(copy, numbers, unpacked);
+    debugPrintTree(unpacked);
+    printf("Found hash %d\n", (int)hash);
+#endif
+    if (state->out) {
+      printTemplated(state->out, &state->templates, copy, numbers);
+    }
+    insert(hash, pos, state);
+  }
+}
+
+// The values reachable from sorted sub-multisets of two and three numbers
+// are cached across puzzles and solver threads. A puzzle whose sub-multisets
+// can't be combined into the target has no solutions and visits no trees.
+// Consecutive puzzles often share three numbers, so a warm cache leaves
+// only a few pair combinations per puzzle.
+//
+// The table is direct mapped and a colliding entry is replaced, which bounds
+// its footprint. Each entry is guarded by a sequence lock: a writer makes
+// the sequence odd while it fills the entry, and a reader that sees the
+// sequence change while copying the entry treats it as a miss. Only numbers
+// up to reachable_max_number in magnitude are cached, so no tree of four of
+// them overflows an int and the results match evalPackedTree.
+enum {
+  reachable_max_number = 215,
+  reachable_max_values = 3 * 6 * 6,
+  reachable_cache_bits = 12,
+  reachable_cache_size = 1 << reachable_cache_bits
+};
+
+struct ReachableSet {
+  unsigned char count, size;
+  int numbers[3];
+  int values[reachable_max_values];
+};
+
+struct ReachableEntry {
+  unsigned sequence;
+  struct ReachableSet set;
+};
+
+struct ReachableCache {
+  uint64_t lookups, hits, skippedPuzzles;
+  struct ReachableEntry entries[reachable_cache_size];
+};
+
+static bool applyOperator(enum OperatorKind kind, int lhs, int rhs,
+                          int *result) {
+  switch (kind) {
+  case op_add:
+    *result = lhs + rhs;
+    return true;
+  case op_sub:
+    *result = lhs - rhs;
+    return true;
+  case op_mul:
+    *result = lhs * rhs;
+    return true;
+  case op_div:
+    if (rhs == 0 || lhs % rhs != 0) {
+      return false;
+    }
+    *result = lhs / rhs;
+    return true;
+  }
+  CANT_REACH
+}
+
+static void addReachable(struct ReachableSet *set, int value) {
+  for (unsigned char i = 0; i < set->size; ++i) {
+    if (set->values[i] == value) {
+      return;
+    }
+  }
+  assert(set->size < reachable_max_values);
+  set->values[set->size++] = value;
+}
+
+// Adds every value of lhs and rhs combined with any operator in any order.
+static void combineReachable(struct ReachableSet *set, int lhs, int rhs) {
+  for (enum OperatorKind kind = op_add; kind <= op_div; ++kind) {
+    int result;
+    if (applyOperator(kind, lhs, rhs, &result)) {
+      addReachable(set, result);
+    }
+    if (applyOperator(kind, rhs, lhs, &result)) {
+      addReachable(set, result);
+    }
+  }
+}
+
+static void computeReachable(const int numbers[], unsigned char count,
+                             struct ReachableSet *set) {
+  set->count = count;
+  set->size = 0;
+  memcpy(set->numbers, numbers, sizeof(*numbers) * count);
+  if (count == 2) {
+    combineReachable(set, numbers[0], numbers[1]);
+    return;
+  }
+  assert(count == 3);
+  for (unsigned char single = 0; single < 3; ++single) {
+    int pairNumbers[2];
+    for (unsigned char i = 0, pos = 0; i < 3; ++i) {
+      if (i != single) {
+        pairNumbers[pos++] = numbers[i];
+      }
+    }
+    struct ReachableSet pair;
+    computeReachable(pairNumbers, 2, &pair);
+    for (unsigned char i = 0; i < pair.size; ++i) {
+      combineReachable(set, pair.values[i], numbers[single]);
+    }
+  }
+}
+
+static size_t reachableSlot(const int numbers[], unsigned char count) {
+  uint64_t hash = count;
+  for (unsigned char i = 0; i < count; ++i) {
+    hash = (hash ^ (uint32_t)numbers[i]) * UINT64_C(0x9e3779b97f4a7c15);
+  }
+  return hash >> (64 - reachable_cache_bits);
+}
+
+// Fills set with the reachable values of the sorted numbers, from the cache
+// if possible.
+static void getReachable(struct ReachableCache *cache, const int numbers[],
+                         unsigned char count, struct ReachableSet *set) {
+  struct ReachableEntry *entry =
+      cache->entries + reachableSlot(numbers, count);
+  RELAXED_FETCH_ADD(&cache->lookups, 1);
+  unsigned sequence = ATOMIC_LOAD(&entry->sequence);
+  bool hit = !(sequence & 1) && RELAXED_LOAD(&entry->set.count) == count;
+  for (unsigned char i = 0; hit && i < count; ++i) {
+    hit = RELAXED_LOAD(entry->set.numbers + i) == numbers[i];
+  }
+  if (hit) {
+    set->count = count;
+    set->size = RELAXED_LOAD(&entry->set.size);
+    memcpy(set->numbers, numbers, sizeof(*numbers) * count);
+    for (unsigned char i = 0; i < set->size; ++i) {
+      set->values[i] = RELAXED_LOAD(entry->set.values + i);
+    }
+    ACQUIRE_FENCE();
+    if (RELAXED_LOAD(&entry->sequence) == sequence) {
+      RELAXED_FETCH_ADD(&cache->hits, 1);
+      return;
+    }
+  }
+  computeReachable(numbers, count, set);
+  // Writers don't wait for each other, the loser just doesn't store.
+  if ((sequence & 1) ||
+      !ATOMIC_COMPARE_EXCHANGE(&entry->sequence, &sequence, sequence + 1)) {
+    return;
+  }
+  RELEASE_FENCE();
+  RELAXED_STORE(&entry->set.count, count);
+  RELAXED_STORE(&entry->set.size, set->size);
+  for (unsigned char i = 0; i < count; ++i) {
+    RELAXED_STORE(entry->set.numbers + i, numbers[i]);
+  }
+  for (unsigned char i = 0; i < set->size; ++i) {
+    RELAXED_STORE(entry->set.values + i, set->values[i]);
+  }
+  ATOMIC_STORE(&entry->sequence, sequence + 2);
+}
+
+static bool reachesTarget(int lhs, int rhs) {
+  for (enum OperatorKind kind = op_add; kind <= op_div; ++kind) {
+    int result;
+    if ((applyOperator(kind, lhs, rhs, &result) && result == target_number) ||
+        (applyOperator(kind, rhs, lhs, &result) && result == target_number)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Whether the reachable values of sub-multisets of the sorted numbers can
+// be combined into the target.
+static bool reachableTarget(struct ReachableCache *cache,
+                            const int numbers[number_count]) {
+  for (unsigned i = 0; i < number_count; ++i) {
+    assert(numbers[i] >= -reachable_max_number &&
+           numbers[i] <= reachable_max_number);
+  }
+  struct ReachableSet set, other;
+  // A triple combined with the remaining number.
+  for (unsigned single = 0; single < number_count; ++single) {
+    if (single > 0 && numbers[single] == numbers[single - 1]) {
+      continue;
+    }
+    int triple[3];
+    for (unsigned i = 0, pos = 0; i < number_count; ++i) {
+      if (i != single) {
+        triple[pos++] = numbers[i];
+      }
+    }
+    getReachable(cache, triple, 3, &set);
+    for (unsigned char i = 0; i < set.size; ++i) {
+      if (reachesTarget(set.values[i], numbers[single])) {
+        return true;
+      }
+    }
+  }
+  // Two pairs.
+  static const unsigned char splits[3][4] = {
+      {0, 1, 2, 3}, {0, 2, 1, 3}, {0, 3, 1, 2}};
+  for (int split = 0; split < 3; ++split) {
+    const unsigned char *s = splits[split];
+    getReachable(cache, (const int[]){numbers[s[0]], numbers[s[1]]}, 2, &set);
+    getReachable(cache, (const int[]){numbers[s[2]], numbers[s[3]]}, 2,
+                 &other);
+    for (unsigned char i = 0; i < set.size; ++i) {
+      for (unsigned char j = 0; j < other.size; ++j) {
+        if (reachesTarget(set.values[i], other.values[j])) {
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+// Returns false only if the sorted numbers certainly have no solution.
+static bool maySolve(struct ReachableCache *cache,
+                     const int numbers[number_count]) {
+  for (unsigned i = 0; i < number_count; ++i) {
+    if (numbers[i] < -reachable_max_number ||
+        numbers[i] > reachable_max_number) {
+      return true;
+    }
+  }
+  if (reachableTarget(cache, numbers)) {
+    return true;
+  }
+  RELAXED_FETCH_ADD(&cache->skippedPuzzles, 1);
+  return false;
+}
+
+static struct ReachableCache *createReachableCache(void) {
+  struct ReachableCache *cache = xmalloc(sizeof(struct ReachableCache));
+  memset(cache, 0, sizeof(struct ReachableCache));
+  return cache;
+}
+
+static void printReachableStats(FILE *out, const struct ReachableCache *cache) {
+  fprintf(out,
+          "reachable cache: %" PRIu64 " lookups, %" PRIu64
+          " hits (%.1f%%), %" PRIu64 " puzzles skipped\n",
+          cache->lookups, cache->hits,
+          cache->lookups ? 100.0 * cache->hits / cache->lookups : 0.0,
+          cache->skippedPuzzles);
+}
+
+static void sortInt(int *first, int *last) {
+  bool sorted = false;
+  while (!sorted) {
+    sorted = true;
+    for (int *pos = first + 1; pos != last; ++pos) {
+      if (*pos < *(pos - 1)) {
+        swap(pos, pos - 1);
+        sorted = false;
+      }
+    }
+  }
+}
+
+static void initSharedState(struct SharedState *state,
+                            struct NearMissHeap *nearMisses) {
+  *state = (struct SharedState){
+      .size = 0,
+      .highWater = 0,
+      .nearMisses = nearMisses->capacity ? nearMisses : NULL,
+      .latency = NULL,
+      .reachable = NULL,
+      .trace = NULL,
+      .features = NULL,
+      .constraints = NULL,
+      .out = stdout};
+  initTemplateCache(&state->templates, format_full);
+}
+
+// Leaves the number of canonical solutions in state->size. Solutions are
+// printed to state->out unless it is NULL.
+static void countSolutions(int numbers[number_count],
+                           struct SharedState *state) {
+  sortInt(numbers, numbers + number_count);
+  state->size = 0;
+  if (state->trace) {
+    tracePuzzle(state->trace, numbers);
+  }
+  if (state->features) {
+    resetFeatures(state->features);
+  }
+  if (state->nearMisses) {
+    state->nearMisses->size = 0;
+  }
+  if (!state->nearMisses && state->reachable &&
+      !maySolve(state->reachable, numbers)) {
+    // Without near misses to report an unsolvable puzzle needs no trees.
+    if (state->trace) {
+      recordTraceEvent(state->trace,
+                       (struct TraceEvent){.tree = 0,
+                                           .value = 0,
+                                           .hash = 0,
+                                           .kind = trace_skipped,
+                                           .flags = 0});
+    }
+  } else {
+    iterateConstrainedTrees(
+        numbers, state->constraints ? state->constraints : &unconstrained,
+        checkAndPrintCallback, state);
+  }
+  if (state->features && state->size == 0) {
+    state->features->fractional = needsFractions(numbers);
+  }
+}
+
+static void solvePuzzle(const int input[number_count],
+                        struct SharedState *state, FILE *out) {
+  int numbers[number_count];
+  memcpy(numbers, input, sizeof(numbers));
+  state->out = out;
+  countSolutions(numbers, state);
+  if (state->size == 0) {
+    fputs("No solutions!\n", out);
+    if (state->nearMisses) {
+      printNearMisses(out, state->nearMisses, &state->templates, numbers);
+    }
+  }
+  if (state->features) {
+    printFeatures(out, state->features, state->size);
+  }
+}
+
+struct NumberedTree {
+  PackedTree tree;
+  unsigned number;
+};
+
+static int compareNumberedTrees(const void *lhs, const void *rhs) {
+  const struct NumberedTree *a = lhs, *b = rhs;
+  return a->tree < b->tree ? -1 : a->tree > b->tree;
+}
+
+// What the decoder knows about the puzzle a thread is solving.
+struct TracedPuzzle {
+  int numbers[number_count];
+  unsigned halves;
+};
+
+static bool decodeTraceEvent(FILE *out, uint32_t thread,
+                             const struct TraceEvent *event,
+                             struct TracedPuzzle *puzzle,
+                             const struct NumberedTree trees[tree_count]) {
+  switch (event->kind) {
+  case trace_puzzle:
+    if (event->value != (puzzle->halves == 1)) {
+      return false;
+    }
+    puzzle->numbers[2 * event->value] = (int32_t)(uint32_t)event->tree;
+    puzzle->numbers[2 * event->value + 1] = (int32_t)(event->tree >> 32);
+    puzzle->halves = event->value + 1;
+    if (puzzle->halves == 2) {
+      fprintf(out, "%u puzzle %d %d %d %d\n", (unsigned)thread,
+              puzzle->numbers[0], puzzle->numbers[1], puzzle->numbers[2],
+              puzzle->numbers[3]);
+    }
+    return true;
+  case trace_skipped:
+    if (puzzle->halves != 2) {
+      return false;
+    }
+    fprintf(out, "%u skipped\n", (unsigned)thread);
+    return true;
+  case trace_tree: {
+    const struct NumberedTree key = {.tree = event->tree, .number = 0};
+    const struct NumberedTree *found =
+        bsearch(&key, trees, tree_count, sizeof(struct NumberedTree),
+                compareNumberedTrees);
+    if (puzzle->halves != 2 || !found) {
+      return false;
+    }
+    fprintf(out, "%u tree %u ", (unsigned)thread, found->number);
+    printPackedTreeImpl(out, event->tree, puzzle->numbers, all_count - 1);
+    if (event->flags & trace_valid) {
+      fprintf(out, " = %d", (int)event->value);
+    } else {
+      fputs(" invalid", out);
+    }
+    if (event->flags & trace_solution) {
+      fprintf(out, " hash %u %s", (unsigned)event->hash,
+              event->flags & trace_duplicate ? "duplicate" : "accepted");
+    }
+    putc('\n', out);
+    return true;
+  }
+  }
+  return false;
+}
+
+// Prints every event of a trace as a line of text, with the thread that
+// recorded it first. Trees are printed with their number and rebuilt from
+// the numbers of their puzzle. Returns false if the trace is malformed.
+static bool decodeTrace(FILE *in, FILE *out) {
+  struct TraceFileHeader header;
+  if (fread(&header, sizeof(header), 1, in) != 1 ||
+      memcmp(header.magic, traceMagic, sizeof(traceMagic)) != 0 ||
+      header.version != trace_format_version ||
+      header.eventSize != sizeof(struct TraceEvent)) {
+    return false;
+  }
+  struct NumberedTree *trees = xmalloc(sizeof(struct NumberedTree) * tree_count);
+  for (unsigned i = 0; i < tree_count; ++i) {
+    trees[i] = (struct NumberedTree){.tree = packedTreeAt(i), .number = i};
+  }
+  qsort(trees, tree_count, sizeof(struct NumberedTree), compareNumberedTrees);
+  struct TracedPuzzle *puzzles =
+      xmalloc(sizeof(struct TracedPuzzle) * max_trace_threads);
+  for (unsigned i = 0; i < max_trace_threads; ++i) {
+    puzzles[i].halves = 0;
+  }
+  struct TraceEvent *events =
+      xmalloc(sizeof(struct TraceEvent) * trace_block_events);
+  struct TraceBlockHeader block;
+  bool valid = true;
+  while (valid && fread(&block, sizeof(block), 1, in) == 1) {
+    valid = block.thread < max_trace_threads &&
+            block.count <= trace_block_events &&
+            fread(events, sizeof(struct TraceEvent), block.count, in) ==
+                block.count;
+    for (uint32_t i = 0; i < block.count && valid; ++i) {
+      valid = decodeTraceEvent(out, block.thread, events + i,
+                               puzzles + block.thread, trees);
+    }
+  }
+  free(events);
+  free(puzzles);
+  free(trees);
+  return valid && !ferror(in);
+}
+
+static int decodeTraceFile(const char *path) {
+  FILE *in = fopen(path, "rb");
+  if (!in) {
+    fprintf(stderr, "error: Can't open %s\n", path);
+    return 1;
+  }
+  const bool valid = decodeTrace(in, stdout);
+  fclose(in);
+  if (!valid) {
+    fprintf(stderr, "error: %s is not a complete trace\n", path);
+    return 1;
+  }
+  return 0;
+}
+
+static uint64_t monotonicNanoseconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+// Solve latencies are recorded in logarithmic buckets like HdrHistogram:
+// values below latency_sub_buckets nanoseconds get a bucket each, above that
+// every power of two is split into latency_sub_buckets buckets. So a bucket
+// is never wider than 1/latency_sub_buckets of its lower bound. Latencies of
+// 2^latency_max_exponent nanoseconds (about 18 minutes) and more share the
+// last bucket.
+enum {
+  latency_sub_bits = 3,
+  latency_sub_buckets = 1 << latency_sub_bits,
+  latency_max_exponent = 40,
+  latency_bucket_count =
+      (latency_max_exponent - latency_sub_bits + 2) * latency_sub_buckets
+};
+
+enum SolveOutcome { outcome_solved, outcome_unsolvable, outcome_count };
+static const char *const outcomeNames[outcome_count] = {"solved",
+                                                        "unsolvable"};
+
+struct LatencyHistogram {
+  uint64_t counts[latency_bucket_count];
+  uint64_t total, sum, min, max;
+};
+
+// Every solver thread records into its own histograms, so recording needs
+// no locks. The counters are written with relaxed atomic stores only so a
+// dump from another thread never reads a torn value.
+struct LatencyRecorder {
+  struct LatencyHistogram outcomes[outcome_count];
+};
+
+struct LatencyReport {
+  const char *mode;
+  bool json;
+  struct LatencyRecorder *recorders;
+  size_t recorderCount;
+};
+
+static volatile sig_atomic_t latencyDumpRequested = 0;
+
+static void requestLatencyDump(int signal) {
+  (void)signal;
+  latencyDumpRequested = 1;
+}
+
+static unsigned latencyBucket(uint64_t nanoseconds) {
+  if (nanoseconds < latency_sub_buckets) {
+    return nanoseconds;
+  }
+  unsigned exponent = latency_sub_bits;
+  while (exponent < latency_max_exponent && nanoseconds >> (exponent + 1)) {
+    ++exponent;
+  }
+  if (nanoseconds >> (exponent + 1)) {
+    return latency_bucket_count - 1;
+  }
+  const unsigned sub =
+      nanoseconds >> (exponent - latency_sub_bits) & (latency_sub_buckets - 1);
+  return (exponent - latency_sub_bits + 1) * latency_sub_buckets + sub;
+}
+
+static uint64_t latencyBucketLow(unsigned bucket) {
+  if (bucket < latency_sub_buckets) {
+    return bucket;
+  }
+  const unsigned shift = bucket / latency_sub_buckets - 1;
+  return (uint64_t)(latency_sub_buckets + bucket % latency_sub_buckets)
+         << shift;
+}
+
+static uint64_t latencyBucketHigh(unsigned bucket) {
+  return bucket + 1 == latency_bucket_count ? UINT64_MAX
+                                            : latencyBucketLow(bucket + 1) - 1;
+}
+
+static void recordLatency(struct LatencyHistogram *histogram,
+                          uint64_t nanoseconds) {
+  uint64_t *const count = histogram->counts + latencyBucket(nanoseconds);
+  RELAXED_STORE(count, RELAXED_LOAD(count) + 1);
+  if (RELAXED_LOAD(&histogram->total) == 0 ||
+      nanoseconds < RELAXED_LOAD(&histogram->min)) {
+    RELAXED_STORE(&histogram->min, nanoseconds);
+  }
+  if (nanoseconds > RELAXED_LOAD(&histogram->max)) {
+    RELAXED_STORE(&histogram->max, nanoseconds);
+  }
+  RELAXED_STORE(&histogram->sum, RELAXED_LOAD(&histogram->sum) + nanoseconds);
+  RELAXED_STORE(&histogram->total, RELAXED_LOAD(&histogram->total) + 1);
+}
+
+static void mergeLatencies(struct LatencyHistogram *into,
+                           const struct LatencyHistogram *from) {
+  const uint64_t total = RELAXED_LOAD(&from->total);
+  if (total == 0) {
+    return;
+  }
+  for (unsigned i = 0; i < latency_bucket_count; ++i) {
+    into->counts[i] += RELAXED_LOAD(from->counts + i);
+  }
+  const uint64_t min = RELAXED_LOAD(&from->min), max = RELAXED_LOAD(&from->max);
+  if (into->total == 0 || min < into->min) {
+    into->min = min;
+  }
+  if (max > into->max) {
+    into->max = max;
+  }
+  into->sum += RELAXED_LOAD(&from->sum);
+  into->total += total;
+}
+
+// The upper bound of the bucket holding the given fraction of all values,
+// which overestimates by at most one bucket width.
+static uint64_t latencyPercentile(const struct LatencyHistogram *histogram,
+                                  double fraction) {
+  uint64_t rank = (uint64_t)(fraction * histogram->total + 0.5), seen = 0;
+  rank = rank < 1 ? 1 : rank;
+  for (unsigned i = 0; i < latency_bucket_count; ++i) {
+    seen += histogram->counts[i];
+    if (seen >= rank) {
+      const uint64_t high = latencyBucketHigh(i);
+      return high < histogram->max ? high : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+static const struct {
+  const char *name;
+  double fraction;
+} latencyPercentiles[] = {
+    {"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99}, {"p999", 0.999}};
+enum {
+  latency_percentile_count =
+      sizeof(latencyPercentiles) / sizeof(*latencyPercentiles)
+};
+
+static void printLatencyText(FILE *out, const char *mode,
+                             enum SolveOutcome outcome,
+                             const struct LatencyHistogram *histogram) {
+  fprintf(out, "latency %s %s: count %" PRIu64, mode, outcomeNames[outcome],
+          histogram->total);
+  if (histogram->total > 0) {
+    fprintf(out, ", min %" PRIu64 " ns, mean %" PRIu64 " ns",
+            histogram->min, histogram->sum / histogram->total);
+    for (size_t i = 0; i < latency_percentile_count; ++i) {
+      fprintf(out, ", %s %" PRIu64 " ns", latencyPercentiles[i].name,
+              latencyPercentile(histogram, latencyPercentiles[i].fraction));
+    }
+    fprintf(out, ", max %" PRIu64 " ns", histogram->max);
+  }
+  putc('\n', out);
+  for (unsigned i = 0; i < latency_bucket_count; ++i) {
+    if (histogram->counts[i]) {
+      fprintf(out, "  %" PRIu64 " - %" PRIu64 " ns: %" PRIu64 "\n",
+              latencyBucketLow(i), latencyBucketHigh(i), histogram->counts[i]);
+    }
+  }
+}
+
+static void printLatencyJson(FILE *out, enum SolveOutcome outcome,
+                             const struct LatencyHistogram *histogram) {
+  fprintf(out, "\"%s\": {\"count\": %" PRIu64, outcomeNames[outcome],
+          histogram->total);
+  if (histogram->total > 0) {
+    fprintf(out, ", \"min\": %" PRIu64 ", \"mean\": %" PRIu64, histogram->min,
+            histogram->sum / histogram->total);
+    for (size_t i = 0; i < latency_percentile_count; ++i) {
+      fprintf(out, ", \"%s\": %" PRIu64, latencyPercentiles[i].name,
+              latencyPercentile(histogram, latencyPercentiles[i].fraction));
+    }
+    fprintf(out, ", \"max\": %" PRIu64, histogram->max);
+  }
+  fputs(", \"buckets\": [", out);
+  const char *separator = "";
+  for (unsigned i = 0; i < latency_bucket_count; ++i) {
+    if (histogram->counts[i]) {
+      fprintf(out, "%s[%" PRIu64 ", %" PRIu64 ", %" PRIu64 "]", separator,
+              latencyBucketLow(i), latencyBucketHigh(i), histogram->counts[i]);
+      separator = ", ";
+    }
+  }
+  fputs("]}", out);
+}
+
+// Merges the histograms of all threads and prints them to stderr. Buckets
+// are given as [low, high, count] with inclusive bounds in nanoseconds.
+static void dumpLatencies(const struct LatencyReport *report) {
+  struct LatencyHistogram *merged =
+      xmalloc(sizeof(struct LatencyHistogram) * outcome_count);
+  memset(merged, 0, sizeof(struct LatencyHistogram) * outcome_count);
+  for (size_t i = 0; i < report->recorderCount; ++i) {
+    for (int outcome = 0; outcome < outcome_count; ++outcome) {
+      mergeLatencies(merged + outcome, report->recorders[i].outcomes + outcome);
+    }
+  }
+  if (report->json) {
+    fprintf(stderr, "{\"mode\": \"%s\", \"unit\": \"ns\", \"outcomes\": {",
+            report->mode);
+    for (int outcome = 0; outcome < outcome_count; ++outcome) {
+      fputs(outcome ? ", " : "", stderr);
+      printLatencyJson(stderr, outcome, merged + outcome);
+    }
+    fputs("}}\n", stderr);
+  } else {
+    for (int outcome = 0; outcome < outcome_count; ++outcome) {
+      printLatencyText(stderr, report->mode, outcome, merged + outcome);
+    }
+  }
+  fflush(stderr);
+  free(merged);
+}
+
+static void dumpRequestedLatencies(const struct LatencyReport *report) {
+  if (report && latencyDumpRequested) {
+    latencyDumpRequested = 0;
+    dumpLatencies(report);
+  }
+}
+
+// In batch mode every puzzle's output is preceded by the puzzle itself.
+static void solveBatchPuzzle(const int numbers[number_count],
+                             struct SharedState *state, FILE *out) {
+  fprintf(out, "%d %d %d %d:\n", numbers[0], numbers[1], numbers[2],
+          numbers[3]);
+  if (!state->latency) {
+    solvePuzzle(numbers, state, out);
+    return;
+  }
+  const uint64_t start = monotonicNanoseconds();
+  solvePuzzle(numbers, state, out);
+  const uint64_t elapsed = monotonicNanoseconds() - start;
+  recordLatency(state->latency->outcomes +
+                    (state->size ? outcome_solved : outcome_unsolvable),
+                elapsed);
+}
+
+enum ParseResult { parse_ok, parse_blank, parse_malformed };
+
+enum CharClass { char_other, char_space, char_digit, char_minus, char_plus };
+
+static const unsigned char charClasses[UCHAR_MAX + 1] = {
+    [' '] = char_space, ['\t'] = char_space, ['\r'] = char_space,
+    ['\n'] = char_space, ['\v'] = char_space, ['\f'] = char_space,
+    ['0'] = char_digit, ['1'] = char_digit, ['2'] = char_digit,
+    ['3'] = char_digit, ['4'] = char_digit, ['5'] = char_digit,
+    ['6'] = char_digit, ['7'] = char_digit, ['8'] = char_digit,
+    ['9'] = char_digit, ['-'] = char_minus, ['+'] = char_plus};
+
+static enum CharClass classify(char c) {
+  return charClasses[(unsigned char)c];
+}
+
+static const char *skipSpaces(const char *pos, const char *end) {
+  while (pos != end && classify(*pos) == char_space) {
+    ++pos;
+  }
+  return pos;
+}
+
+// Parses the numbers of a puzzle from a line that is not null terminated.
+static enum ParseResult parsePuzzleLine(const char *line, size_t size,
+                                        int numbers[number_count]) {
+  const char *pos = skipSpaces(line, line + size), *const end = line + size;
+  if (pos == end) {
+    return parse_blank;
+  }
+  for (int i = 0; i < number_count; ++i) {
+    pos = skipSpaces(pos, end);
+    bool negative = false;
+    if (pos != end && classify(*pos) >= char_minus) {
+      negative = classify(*pos++) == char_minus;
+    }
+    if (pos == end || classify(*pos) != char_digit) {
+      return parse_malformed;
+    }
+    const unsigned long limit = negative ? -(unsigned long)INT_MIN : INT_MAX;
+    unsigned long value = 0;
+    for (; pos != end && classify(*pos) == char_digit; ++pos) {
+      value = value * 10 + (*pos - '0');
+      if (value > limit) {
+        return parse_malformed;
+      }
+    }
+    numbers[i] = negative ? (int)-(long)value : (int)value;
+    if (pos != end && classify(*pos) != char_space) {
+      return parse_malformed;
+    }
+  }
+  return skipSpaces(pos, end) == end ? parse_ok : parse_malformed;
+}
+
+// Hands out the lines of the input. Regular files are memory mapped and the
+// lines point into the mapping; anything else is read line by line, and each
+// line is only valid until the next one is requested.
+struct PuzzleReader {
+  const char *map;
+  size_t mapSize, offset;
+  FILE *stream;
+  char *line;
+  size_t capacity;
+  size_t lineNumber;
+};
+
+static void openPuzzleReader(struct PuzzleReader *reader, FILE *stream) {
+  *reader = (struct PuzzleReader){.map = NULL,
+                                  .mapSize = 0,
+                                  .offset = 0,
+                                  .stream = stream,
+                                  .line = NULL,
+                                  .capacity = 0,
+                                  .lineNumber = 0};
+  struct stat info;
+  const int fd = fileno(stream);
+  if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+    return;
+  }
+  void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    return;
+  }
+  posix_madvise(map, info.st_size, POSIX_MADV_SEQUENTIAL);
+  reader->map = map;
+  reader->mapSize = info.st_size;
+}
+
+static bool isMapped(const struct PuzzleReader *reader) {
+  return reader->map != NULL;
+}
+
+static bool nextLine(struct PuzzleReader *reader, const char **line,
+                     size_t *size) {
+  if (isMapped(reader)) {
+    if (reader->offset == reader->mapSize) {
+      return false;
+    }
+    const char *const begin = reader->map + reader->offset;
+    const char *newline =
+        memchr(begin, '\n', reader->mapSize - reader->offset);
+    const char *const end = newline ? newline : reader->map + reader->mapSize;
+    reader->offset = end - reader->map + (newline != NULL);
+    *line = begin;
+    *size = end - begin;
+  } else {
+    const ssize_t read = getline(&reader->line, &reader->capacity,
+                                 reader->stream);
+    if (read == -1) {
+      return false;
+    }
+    *line = reader->line;
+    *size = read;
+  }
+  ++reader->lineNumber;
+  return true;
+}
+
+static void closePuzzleReader(struct PuzzleReader *reader) {
+  if (isMapped(reader)) {
+    munmap((void *)reader->map, reader->mapSize);
+  }
+  free(reader->line);
+}
+
+static void reportMalformedLine(size_t lineNumber) {
+  fprintf(stderr, "error: Input is malformed on line %lu\n",
+          (unsigned long)lineNumber);
+}
+
+static int solveBatchSerial(FILE *in, size_t nearMissCount,
+                            const struct TreeConstraints *constraints,
+                            enum OutputFormat format,
+                            struct LatencyReport *latency,
+                            struct ReachableCache *reachable,
+                            struct TraceWriter *trace, bool measuring) {
+  static struct NearMissHeap nearMisses;
+  nearMisses.capacity = nearMissCount;
+  struct SharedState state;
+  initSharedState(&state, &nearMisses);
+  struct DifficultyFeatures features;
+  state.features = measuring ? &features : NULL;
+  state.latency = latency ? latency->recorders : NULL;
+  state.reachable = reachable;
+  state.trace = trace ? claimTraceRecorder(trace) : NULL;
+  state.constraints = constraints;
+  state.templates.format = format;
+  struct PuzzleReader reader;
+  openPuzzleReader(&reader, in);
+  const char *line;
+  size_t size;
+  int ret = 0;
+  while (ret == 0 && nextLine(&reader, &line, &size)) {
+    int numbers[number_count];
+    switch (parsePuzzleLine(line, size, numbers)) {
+    case parse_ok:
+      solveBatchPuzzle(numbers, &state, stdout);
+      if (latency && latencyDumpRequested) {
+        fflush(stdout);
+        dumpRequestedLatencies(latency);
+      }
+      break;
+    case parse_blank:
+      break;
+    case parse_malformed:
+      fflush(stdout);
+      reportMalformedLine(reader.lineNumber);
+      ret = 1;
+      break;
+    }
+  }
+  closePuzzleReader(&reader);
+  return ret;
+}
+
+#ifdef HAVE_ATOMICS
+// The pipeline consists of the reading main thread, a pool of solver threads
+// and a writer thread. They share a ring of slots; the state of a slot is its
+// job's sequence number times job_phase_count plus its phase. A job can only
+// be read once the writer is done with the job one ring size earlier, so
+// the memory use is bounded no matter how large the input is. As the writer
+// consumes jobs by their sequence number the output stays in input order.
+// Each job is a single input line, which the solver parses itself. Lines of
+// a mapped input are not copied. A slot's output goes to a memory stream
+// that is rewound for every job, so its buffer grows to the largest output
+// of any puzzle and is reused after that.
+enum JobPhase { job_empty, job_read, job_solved, job_phase_count };
+enum { slots_per_worker = 4 };
+
+struct PipelineSlot {
+  size_t state;
+  const char *line;
+  size_t lineSize, lineNumber;
+  char *lineCopy;
+  size_t lineCopyCapacity;
+  bool malformed;
+  // Only valid after out is flushed.
+  char *output;
+  size_t outputSize, outputCapacity;
+  FILE *out;
+};
+
+struct Pipeline {
+  struct PipelineSlot *slots;
+  size_t slotCount;
+  size_t nextJob;
+  size_t readJobs;
+  bool inputDone;
+  bool failed;
+  size_t failedLine;
+  size_t nearMissCount;
+  const struct TreeConstraints *constraints;
+  enum OutputFormat format;
+  struct LatencyReport *latency;
+  size_t nextRecorder;
+  struct ReachableCache *reachable;
+  struct TraceWriter *trace;
+  bool measuring;
+};
+
+// Waits until the slot reaches the given state. Returns false if the input
+// ended before the job was read or the pipeline was stopped by an error.
+static bool waitForJob(struct Pipeline *pipeline, struct PipelineSlot *slot,
+                       size_t job, enum JobPhase phase) {
+  unsigned spins = 0;
+  while (ATOMIC_LOAD(&slot->state) != job * job_phase_count + phase) {
+    if (ATOMIC_LOAD(&pipeline->failed) ||
+        (ATOMIC_LOAD(&pipeline->inputDone) &&
+         job >= ATOMIC_LOAD(&pipeline->readJobs))) {
+      return false;
+    }
+    backoff(&spins);
+  }
+  return true;
+}
+
+static void *solverThread(void *data) {
+  struct Pipeline *pipeline = data;
+  struct NearMissHeap *nearMisses = xmalloc(sizeof(struct NearMissHeap));
+  nearMisses->capacity = pipeline->nearMissCount;
+  struct SharedState state;
+  initSharedState(&state, nearMisses);
+  struct DifficultyFeatures features;
+  state.features = pipeline->measuring ? &features : NULL;
+  state.reachable = pipeline->reachable;
+  state.trace = pipeline->trace ? claimTraceRecorder(pipeline->trace) : NULL;
+  state.constraints = pipeline->constraints;
+  state.templates.format = pipeline->format;
+  if (pipeline->latency) {
+    state.latency = pipeline->latency->recorders +
+                    ATOMIC_FETCH_ADD(&pipeline->nextRecorder, 1);
+  }
+  for (;;) {
+    const size_t job = ATOMIC_FETCH_ADD(&pipeline->nextJob, 1);
+    struct PipelineSlot *slot =
+        pipeline->slots + job % pipeline->slotCount;
+    if (!waitForJob(pipeline, slot, job, job_read)) {
+      break;
+    }
+    int numbers[number_count];
+    slot->malformed = false;
+    slot->outputSize = 0;
+    switch (parsePuzzleLine(slot->line, slot->lineSize, numbers)) {
+    case parse_ok:
+      rewind(slot->out);
+      solveBatchPuzzle(numbers, &state, slot->out);
+      // The stream only fails when it can't grow its buffer.
+      if (fflush(slot->out) != 0 || ferror(slot->out)) {
+        handleOutOfMemory();
+      }
+      slot->outputSize = ftell(slot->out);
+      break;
+    case parse_blank:
+      break;
+    case parse_malformed:
+      slot->malformed = true;
+      break;
+    }
+    ATOMIC_STORE(&slot->state, job * job_phase_count + job_solved);
+  }
+  free(nearMisses);
+  return NULL;
+}
+
+static void *writerThread(void *data) {
+  struct Pipeline *pipeline = data;
+  for (size_t job = 0;; ++job) {
+    struct PipelineSlot *slot =
+        pipeline->slots + job % pipeline->slotCount;
+    if (!waitForJob(pipeline, slot, job, job_solved)) {
+      break;
+    }
+    if (slot->malformed) {
+      pipeline->failedLine = slot->lineNumber;
+      ATOMIC_STORE(&pipeline->failed, true);
+      break;
+    }
+    fwrite(slot->output, 1, slot->outputSize, stdout);
+    ATOMIC_STORE(&slot->state,
+                 (job + pipeline->slotCount) * job_phase_count + job_empty);
+    if (pipeline->latency && latencyDumpRequested) {
+      fflush(stdout);
+      dumpRequestedLatencies(pipeline->latency);
+    }
+  }
+  fflush(stdout);
+  return NULL;
+}
+
+static int solveBatchPipelined(FILE *in, size_t nearMissCount,
+                               const struct TreeConstraints *constraints,
+                               enum OutputFormat format,
+                               unsigned workers,
+                               struct LatencyReport *latency,
+                               struct ReachableCache *reachable,
+                               struct TraceWriter *trace, bool measuring) {
+  struct Pipeline pipeline = {.slotCount = workers * slots_per_worker,
+                              .nextJob = 0,
+                              .readJobs = 0,
+                              .inputDone = false,
+                              .failed = false,
+                              .failedLine = 0,
+                              .nearMissCount = nearMissCount,
+                              .constraints = constraints,
+                              .format = format,
+                              .latency = latency,
+                              .nextRecorder = 0,
+                              .reachable = reachable,
+                              .trace = trace,
+                              .measuring = measuring};
+  pipeline.slots = xmalloc(sizeof(struct PipelineSlot) * pipeline.slotCount);
+  for (size_t i = 0; i < pipeline.slotCount; ++i) {
+    struct PipelineSlot *slot = pipeline.slots + i;
+    slot->state = i * job_phase_count + job_empty;
+    slot->lineCopy = NULL;
+    slot->lineCopyCapacity = 0;
+    slot->output = NULL;
+    slot->out = open_memstream(&slot->output, &slot->outputCapacity);
+    if (!slot->out) {
+      handleOutOfMemory();
+    }
+  }
+  pthread_t writer, *solvers = xmalloc(sizeof(pthread_t) * workers);
+  pthread_create(&writer, NULL, writerThread, &pipeline);
+  for (unsigned i = 0; i < workers; ++i) {
+    pthread_create(solvers + i, NULL, solverThread, &pipeline);
+  }
+
+  struct PuzzleReader reader;
+  openPuzzleReader(&reader, in);
+  const char *line;
+  size_t size;
+  for (size_t job = 0; nextLine(&reader, &line, &size); ++job) {
+    struct PipelineSlot *slot = pipeline.slots + job % pipeline.slotCount;
+    if (!waitForJob(&pipeline, slot, job, job_empty)) {
+      break;
+    }
+    if (!isMapped(&reader)) {
+      if (slot->lineCopyCapacity < size) {
+        slot->lineCopyCapacity = size;
+        slot->lineCopy = xrealloc(slot->lineCopy, size);
+      }
+      memcpy(slot->lineCopy, line, size);
+      line = slot->lineCopy;
+    }
+    slot->line = line;
+    slot->lineSize = size;
+    slot->lineNumber = reader.lineNumber;
+    ATOMIC_STORE(&slot->state, job * job_phase_count + job_read);
+    ATOMIC_STORE(&pipeline.readJobs, job + 1);
+  }
+  ATOMIC_STORE(&pipeline.inputDone, true);
+
+  for (unsigned i = 0; i < workers; ++i) {
+    pthread_join(solvers[i], NULL);
+  }
+  pthread_join(writer, NULL);
+  for (size_t i = 0; i < pipeline.slotCount; ++i) {
+    fclose(pipeline.slots[i].out);
+    free(pipeline.slots[i].output);
+    free(pipeline.slots[i].lineCopy);
+  }
+  free(solvers);
+  free(pipeline.slots);
+  closePuzzleReader(&reader);
+  if (pipeline.failed) {
+    reportMalformedLine(pipeline.failedLine);
+    return 1;
+  }
+  return 0;
+}
+#endif
+
+// Verification checks answers of the form "a b c d: expression", one per
+// line. Expressions use the usual precedence, operators of equal precedence
+// associate to the left, and a number may carry a sign. The parser writes
+// the numbers to the first slots of a SyntaxTree and every operator after
+// its operands, as iteratePackedTrees does, and allocates nothing. An
+// answer reaching the target is looked up among the solver's canonical
+// solutions of the puzzle by its signature.
+enum { max_answer_nesting = 64 };
+
+enum Verdict {
+  verdict_correct,
+  verdict_unlisted,
+  verdict_wrong,
+  verdict_invalid,
+  verdict_mismatch,
+  verdict_malformed
+};
+
+struct AnswerParser {
+  const char *pos, *end;
+  SyntaxTree tree;
+  unsigned numberCount, operatorCount, nesting;
+  // Set once the answer has more numbers than the puzzle.
+  bool overflow;
+};
+
+static int parseAnswerSum(struct AnswerParser *parser);
+
+static bool acceptAnswerChar(struct AnswerParser *parser, char c) {
+  parser->pos = skipSpaces(parser->pos, parser->end);
+  if (parser->pos == parser->end || *parser->pos != c) {
+    return false;
+  }
+  ++parser->pos;
+  return true;
+}
+
+// Parses a number or a parenthesized expression and returns its node, or -1.
+static int parseAnswerOperand(struct AnswerParser *parser) {
+  if (acceptAnswerChar(parser, '(')) {
+    if (++parser->nesting > max_answer_nesting) {
+      return -1;
+    }
+    const int node = parseAnswerSum(parser);
+    --parser->nesting;
+    return node >= 0 && acceptAnswerChar(parser, ')') ? node : -1;
+  }
+  const char *pos = parser->pos, *const end = parser->end;
+  bool negative = false;
+  if (pos != end && classify(*pos) >= char_minus) {
+    negative = classify(*pos++) == char_minus;
+  }
+  if (pos == end || classify(*pos) != char_digit) {
+    return -1;
+  }
+  const unsigned long limit = negative ? -(unsigned long)INT_MIN : INT_MAX;
+  unsigned long value = 0;
+  for (; pos != end && classify(*pos) == char_digit; ++pos) {
+    value = value * 10 + (*pos - '0');
+    if (value > limit) {
+      return -1;
+    }
+  }
+  parser->pos = pos;
+  if (parser->numberCount == number_count) {
+    parser->overflow = true;
+    return -1;
+  }
+  parser->tree[parser->numberCount] = (struct Node){
+      .kind = node_number, .v.n = negative ? (int)-(long)value : (int)value};
+  return parser->numberCount++;
+}
+
+// Every operator joins two operands that hold at least one number each, so
+// there are fewer operators than numbers.
+static int addAnswerOperator(struct AnswerParser *parser,
+                             enum OperatorKind kind, int lhs, int rhs) {
+  assert(parser->operatorCount < ops_count);
+  const int node = number_count + parser->operatorCount++;
+  parser->tree[node] = (struct Node){
+      .kind = node_operator, .v.op = {.kind = kind, .lhs = lhs, .rhs = rhs}};
+  return node;
+}
+
+// Parses operands joined by the operators first and first + 1.
+static int parseAnswerChain(struct AnswerParser *parser,
+                            enum OperatorKind first,
+                            int (*parseOperand)(struct AnswerParser *)) {
+  int lhs = parseOperand(parser);
+  while (lhs >= 0) {
+    enum OperatorKind kind;
+    if (acceptAnswerChar(parser, opChars[first])) {
+      kind = first;
+    } else if (acceptAnswerChar(parser, opChars[first + 1])) {
+      kind = first + 1;
+    } else {
+      break;
+    }
+    const int rhs = parseOperand(parser);
+    lhs = rhs >= 0 ? addAnswerOperator(parser, kind, lhs, rhs) : -1;
+  }
+  return lhs;
+}
+
+static int parseAnswerProduct(struct AnswerParser *parser) {
+  return parseAnswerChain(parser, op_mul, parseAnswerOperand);
+}
+
+static int parseAnswerSum(struct AnswerParser *parser) {
+  return parseAnswerChain(parser, op_add, parseAnswerProduct);
+}
+
+// The canonical solutions of the puzzle solved last. Most answers don't
+// reach the target, so a puzzle is only solved once an answer does, and
+// consecutive answers to it share the solve.
+struct KnownSolutions {
+  struct SharedState state;
+  int numbers[number_count];
+  bool solved;
+};
+
+static void initKnownSolutions(struct KnownSolutions *known) {
+  static struct NearMissHeap noNearMisses;
+  initSharedState(&known->state, &noNearMisses);
+  known->state.out = NULL;
+  known->solved = false;
+}
+
+// Whether the canonical solutions of the sorted numbers include one with the
+// signature hash.
+static bool isKnownSolution(struct KnownSolutions *known,
+                            const int numbers[number_count], uint16_t hash) {
+  if (!known->solved ||
+      memcmp(known->numbers, numbers, sizeof(known->numbers)) != 0) {
+    memcpy(known->numbers, numbers, sizeof(known->numbers));
+    countSolutions(known->numbers, &known->state);
+    known->solved = true;
+  }
+  uint16_t *end = known->state.seenTrees + known->state.size,
+           *pos = upperBound(known->state.seenTrees, end, hash);
+  return pos != end && *pos == hash;
+}
+
+// Checks the answer to the sorted numbers. An answer reaching the target is
+// correct if it is equivalent to one of the solver's solutions and unlisted
+// otherwise. Either way it is left in canonical form in solution, with its
+// numbers indexing the sorted ones, so it prints like the solver's solution
+// of the same class.
+static enum Verdict verifyAnswer(const char *answer, size_t size,
+                                 const int numbers[number_count],
+                                 struct KnownSolutions *known,
+                                 PackedTree *solution, int *value) {
+  struct AnswerParser parser = {.pos = answer,
+                                .end = answer + size,
+                                .numberCount = 0,
+                                .operatorCount = 0,
+                                .nesting = 0,
+                                .overflow = false};
+  const int root = parseAnswerSum(&parser);
+  if (parser.overflow ||
+      (root >= 0 && parser.numberCount != number_count)) {
+    return verdict_mismatch;
+  }
+  if (root < 0 || skipSpaces(parser.pos, parser.end) != parser.end) {
+    return verdict_malformed;
+  }
+  assert(root == all_count - 1);
+  // Each number takes the first unused index of an equal puzzle number.
+  unsigned used = 0;
+  PackedTree tree = 0;
+  for (unsigned i = 0; i < all_count; ++i) {
+    const struct Node *node = parser.tree + i;
+    if (node->kind == node_operator) {
+      setPackedSlot(&tree, i,
+                    makePackedOperator(node->v.op.kind, node->v.op.lhs,
+                                       node->v.op.rhs));
+      continue;
+    }
+    unsigned idx = 0;
+    while (idx < number_count &&
+           ((used >> idx & 1) || numbers[idx] != node->v.n)) {
+      ++idx;
+    }
+    if (idx == number_count) {
+      return verdict_mismatch;
+    }
+    used |= 1u << idx;
+    setPackedSlot(&tree, i, makePackedNumber(idx));
+  }
+  const EvalResult res = evalPackedTree(tree, numbers, all_count - 1);
+  if (!res.valid) {
+    return verdict_invalid;
+  }
+  *value = res.num;
+  if (res.num != target_number) {
+    return verdict_wrong;
+  }
+  unsigned char classes[number_count];
+  numberClasses(numbers, classes);
+  const bool listed =
+      isKnownSolution(known, numbers, canonicalSignature(tree, classes));
+  canonicalizePackedTree(&tree, classes);
+  *solution = tree;
+  return listed ? verdict_correct : verdict_unlisted;
+}
+
+// Prints one verdict per line: "correct" with the canonical form of the
+// answer if it matches a solution of the solver, "unlisted" with it if it
+// reaches the target but matches none, "wrong" with its value, "invalid" for
+// an inexact division, "mismatch" if it doesn't use exactly the puzzle's
+// numbers or "malformed". Blank lines are skipped.
+static int verifyAnswers(FILE *in) {
+  struct PuzzleReader reader;
+  openPuzzleReader(&reader, in);
+  struct KnownSolutions known;
+  initKnownSolutions(&known);
+  const char *line;
+  size_t size;
+  while (nextLine(&reader, &line, &size)) {
+    if (skipSpaces(line, line + size) == line + size) {
+      continue;
+    }
+    const char *colon = memchr(line, ':', size);
+    int numbers[number_count];
+    PackedTree solution;
+    int value;
+    enum Verdict verdict = verdict_malformed;
+    if (colon && parsePuzzleLine(line, colon - line, numbers) == parse_ok) {
+      sortInt(numbers, numbers + number_count);
+      verdict = verifyAnswer(colon + 1, line + size - colon - 1, numbers,
+                             &known, &solution, &value);
+    }
+    switch (verdict) {
+    case verdict_correct:
+      fputs("correct ", stdout);
+      printPackedTree(stdout, solution, numbers);
+      break;
+    case verdict_unlisted:
+      fputs("unlisted ", stdout);
+      printPackedTree(stdout, solution, numbers);
+      break;
+    case verdict_wrong:
+      printf("wrong %d\n", value);
+      break;
+    case verdict_invalid:
+      puts("invalid");
+      break;
+    case verdict_mismatch:
+      puts("mismatch");
+      break;
+    case verdict_malformed:
+      puts("malformed");
+      break;
+    }
+  }
+  closePuzzleReader(&reader);
+  return 0;
+}
+
+// Real-valued puzzles take decimal numbers and targets. Every tree is
+// evaluated in double precision, and a value within epsilon of the target
+// is confirmed with exact rational arithmetic before it counts, so rounding
+// never produces a false solution. Solutions are deduplicated and printed
+// like integer ones.
+//
+// The kernel evaluates all operator triples of one wiring at once: a lane
+// per triple, indexed like the operator bits of packedTreeAt. The operator
+// of a slot is the same over runs of lanes, which are simple loops that
+// compilers vectorize. A division by zero yields NaN, which masks the lane
+// out of every later operation and the final comparison.
+enum {
+  real_lanes = 1 << (2 * ops_count),
+  // Decimals have at most this many digits after the point and this many
+  // in total.
+  real_max_scale = 6,
+  real_max_digits = 12
+};
+
+struct Rational {
+  int64_t num, den;
+};
+
+// How exact evaluation ended. A value that doesn't fit in int64_t fractions
+// may still be a solution, so it is told apart from a division by zero.
+enum ExactStatus { exact_value, exact_undefined, exact_overflow };
+
+struct RealNumber {
+  struct Rational exact;
+  double value;
+};
+
+static int64_t gcdInt64(int64_t a, int64_t b) {
+  a = a < 0 ? -a : a;
+  while (b != 0) {
+    const int64_t rest = a % b;
+    a = b;
+    b = rest;
+  }
+  return a;
+}
+
+static bool checkedAdd(int64_t a, int64_t b, int64_t *result) {
+  if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < -INT64_MAX - b)) {
+    return false;
+  }
+  *result = a + b;
+  return true;
+}
+
+static bool checkedMul(int64_t a, int64_t b, int64_t *result) {
+  const uint64_t ua = a < 0 ? -(uint64_t)a : (uint64_t)a,
+                 ub = b < 0 ? -(uint64_t)b : (uint64_t)b;
+  if (ua != 0 && ub > (uint64_t)INT64_MAX / ua) {
+    return false;
+  }
+  *result = a * b;
+  return true;
+}
+
+static enum ExactStatus applyRational(enum OperatorKind kind,
+                                      struct Rational lhs, struct Rational rhs,
+                                      struct Rational *result) {
+  int64_t num, den, cross;
+  switch (kind) {
+  case op_sub:
+    rhs.num = -rhs.num;
+    // fall through
+  case op_add:
+    if (!checkedMul(lhs.num, rhs.den, &num) ||
+        !checkedMul(rhs.num, lhs.den, &cross) ||
+        !checkedAdd(num, cross, &num) ||
+        !checkedMul(lhs.den, rhs.den, &den)) {
+      return exact_overflow;
+    }
+    break;
+  case op_div:
+    if (rhs.num == 0) {
+      return exact_undefined;
+    }
+    rhs = rhs.num < 0 ? (struct Rational){-rhs.den, -rhs.num}
+                      : (struct Rational){rhs.den, rhs.num};
+    // fall through
+  case op_mul:
+    if (!checkedMul(lhs.num, rhs.num, &num) ||
+        !checkedMul(lhs.den, rhs.den, &den)) {
+      return exact_overflow;
+    }
+    break;
+  }
+  const int64_t divisor = gcdInt64(num, den);
+  *result = (struct Rational){num / divisor, den / divisor};
+  return exact_value;
+}
+
+// A division by zero anywhere makes the whole tree undefined, even if
+// another subtree overflowed.
+static enum ExactStatus evalRationalTree(PackedTree tree,
+                                         const struct RealNumber numbers[],
+                                         unsigned idx,
+                                         struct Rational *result) {
+  const unsigned slot = packedSlot(tree, idx);
+  if (slotKind(slot) == node_number) {
+    *result = numbers[slotNumber(slot)].exact;
+    return exact_value;
+  }
+  struct Rational lhs, rhs;
+  const enum ExactStatus left = evalRationalTree(tree, numbers, slotLhs(slot),
+                                                &lhs);
+  const enum ExactStatus right = evalRationalTree(tree, numbers, slotRhs(slot),
+                                                 &rhs);
+  if (left == exact_undefined || right == exact_undefined) {
+    return exact_undefined;
+  }
+  if (left == exact_overflow || right == exact_overflow) {
+    return slotOperator(slot) == op_div && right == exact_value && rhs.num == 0
+               ? exact_undefined
+               : exact_overflow;
+  }
+  return applyRational(slotOperator(slot), lhs, rhs, result);
+}
+
+// Parses a decimal like -1.25 into a reduced fraction. The whole of arg has
+// to be the number.
+static int parseDecimal(const char *arg, struct RealNumber *number) {
+  const bool negative = *arg == '-';
+  const char *pos = arg + (negative || *arg == '+');
+  int64_t num = 0, den = 1;
+  unsigned digits = 0, scale = 0;
+  bool point = false;
+  for (; *pos; ++pos) {
+    if (*pos == '.' && !point) {
+      point = true;
+      continue;
+    }
+    if (classify(*pos) != char_digit || ++digits > real_max_digits ||
+        (point && ++scale > real_max_scale)) {
+      return 1;
+    }
+    num = num * 10 + (*pos - '0');
+    den *= point ? 10 : 1;
+  }
+  if (digits == 0) {
+    return 1;
+  }
+  const int64_t divisor = gcdInt64(num, den);
+  number->exact = (struct Rational){(negative ? -num : num) / divisor,
+                                    den / divisor};
+  number->value = (double)number->exact.num / number->exact.den;
+  return 0;
+}
+
+// Prints the number with as many places as it needs. Its denominator
+// divides a power of ten, so the long division ends.
+static void printDecimal(FILE *out, const struct RealNumber *number) {
+  const struct Rational *exact = &number->exact;
+  const uint64_t den = exact->den,
+                 magnitude = exact->num < 0 ? -(uint64_t)exact->num
+                                            : (uint64_t)exact->num;
+  fprintf(out, "%s%" PRIu64, exact->num < 0 ? "-" : "", magnitude / den);
+  uint64_t rest = magnitude % den;
+  if (rest != 0) {
+    putc('.', out);
+  }
+  for (; rest != 0; rest %= den) {
+    rest *= 10;
+    putc('0' + (int)(rest / den), out);
+  }
+}
+
+static void printRealTreeImpl(FILE *out, PackedTree tree,
+                              const struct RealNumber numbers[],
+                              unsigned idx) {
+  const unsigned slot = packedSlot(tree, idx);
+  switch (slotKind(slot)) {
+  case node_number:
+    printDecimal(out, numbers + slotNumber(slot));
+    break;
+  case node_operator:
+    putc('(', out);
+    printRealTreeImpl(out, tree, numbers, slotLhs(slot));
+    fprintf(out, " %c ", opChars[slotOperator(slot)]);
+    printRealTreeImpl(out, tree, numbers, slotRhs(slot));
+    putc(')', out);
+  }
+}
+
+// Applies kind to count lanes. A zero divisor is replaced by NaN, which
+// every later operation propagates and no comparison accepts.
+static void applyRealOperator(enum OperatorKind kind, const double *l,
+                              const double *r, double *restrict v,
+                              unsigned count) {
+  switch (kind) {
+  case op_add:
+    for (unsigned lane = 0; lane < count; ++lane) {
+      v[lane] = l[lane] + r[lane];
+    }
+    break;
+  case op_sub:
+    for (unsigned lane = 0; lane < count; ++lane) {
+      v[lane] = l[lane] - r[lane];
+    }
+    break;
+  case op_mul:
+    for (unsigned lane = 0; lane < count; ++lane) {
+      v[lane] = l[lane] * r[lane];
+    }
+    break;
+  case op_div:
+    for (unsigned lane = 0; lane < count; ++lane) {
+      v[lane] = l[lane] / (r[lane] != 0 ? r[lane] : NAN);
+    }
+    break;
+  }
+}
+
+// Fills the lanes of slot idx of the wiring from its operands' lanes. The
+// operator of the slot changes every 1 << shift lanes.
+static void evalRealLevel(PackedTree wiring, unsigned idx,
+                          double values[all_count][real_lanes]) {
+  const unsigned slot = packedSlot(wiring, idx),
+                 block = 1u << 2 * (idx - number_count);
+  const double *l = values[slotLhs(slot)], *r = values[slotRhs(slot)];
+  for (unsigned first = 0; first < real_lanes; first += 4 * block) {
+    for (unsigned kind = op_add; kind <= op_div; ++kind) {
+      const unsigned lane = first + kind * block;
+      applyRealOperator(kind, l + lane, r + lane, values[idx] + lane, block);
+    }
+  }
+}
+
+struct RealPuzzle {
+  struct RealNumber numbers[number_count];
+  struct RealNumber target;
+  double epsilon;
+};
+
+// Sets bit opBits of matches[wiring] for every tree whose value is within
+// epsilon of the target.
+static void findRealCandidates(const struct RealPuzzle *puzzle,
+                               uint64_t matches[wiring_count]) {
+  double values[all_count][real_lanes];
+  for (unsigned i = 0; i < number_count; ++i) {
+    for (unsigned lane = 0; lane < real_lanes; ++lane) {
+      values[i][lane] = puzzle->numbers[i].value;
+    }
+  }
+  const double low = puzzle->target.value - puzzle->epsilon,
+               high = puzzle->target.value + puzzle->epsilon;
+  for (unsigned wiring = 0; wiring < wiring_count; ++wiring) {
+    const PackedTree tree = packedTreeAt(wiring);
+    for (unsigned idx = number_count; idx < all_count; ++idx) {
+      evalRealLevel(tree, idx, values);
+    }
+    uint64_t mask = 0;
+    for (unsigned lane = 0; lane < real_lanes; ++lane) {
+      const double value = values[all_count - 1][lane];
+      mask |= (uint64_t)((value >= low) & (value <= high)) << lane;
+    }
+    matches[wiring] = mask;
+  }
+}
+
+// The index of the lowest set bit of a nonzero mask.
+static unsigned lowestSetBit(uint64_t bits) {
+#ifdef __GNUC__
+  return __builtin_ctzll(bits);
+#else
+  unsigned bit = 0;
+  while (!(bits >> bit & 1)) {
+    ++bit;
+  }
+  return bit;
+#endif
+}
+
+// Whether some tree reaches the target when divisions may leave fractions.
+static bool needsFractions(const int numbers[number_count]) {
+  struct RealPuzzle puzzle = {
+      .target = {{target_number, 1}, target_number}, .epsilon = 1e-6};
+  for (unsigned i = 0; i < number_count; ++i) {
+    puzzle.numbers[i] = (struct RealNumber){{numbers[i], 1}, numbers[i]};
+  }
+  uint64_t matches[wiring_count];
+  findRealCandidates(&puzzle, matches);
+  for (unsigned wiring = 0; wiring < wiring_count; ++wiring) {
+    for (uint64_t lanes = matches[wiring]; lanes; lanes &= lanes - 1) {
+      const unsigned ops = lowestSetBit(lanes);
+      struct Rational value;
+      if (evalRationalTree(packedTreeAt(ops * wiring_count + wiring),
+                           puzzle.numbers, all_count - 1,
+                           &value) == exact_value &&
+          value.num == target_number && value.den == 1) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Like numberClasses. Exact values are kept in lowest terms, so equal
+// numbers have equal fractions.
+static void realNumberClasses(const struct RealNumber numbers[number_count],
+                              unsigned char classes[number_count]) {
+  for (unsigned char i = 0; i != number_count; ++i) {
+    classes[i] = 0;
+    while (numbers[classes[i]].exact.num != numbers[i].exact.num ||
+           numbers[classes[i]].exact.den != numbers[i].exact.den) {
+      ++classes[i];
+    }
+  }
+}
+
+// Prints the canonical solutions in the order the integer solver would
+// find them and leaves their number in state->size. Returns how many
+// candidates the kernel found that were too large to check exactly.
+static unsigned solveRealPuzzle(struct RealPuzzle *puzzle,
+                                struct SharedState *state, FILE *out) {
+  for (unsigned i = 1; i < number_count; ++i) {
+    for (unsigned j = i; j > 0 && puzzle->numbers[j].value <
+                                      puzzle->numbers[j - 1].value;
+         --j) {
+      swap(puzzle->numbers + j, puzzle->numbers + j - 1);
+    }
+  }
+  unsigned char classes[number_count];
+  realNumberClasses(puzzle->numbers, classes);
+  uint64_t matches[wiring_count];
+  findRealCandidates(puzzle, matches);
+  unsigned unchecked = 0;
+  state->size = 0;
+  for (unsigned ops = 0; ops < operator_triples; ++ops) {
+    for (unsigned wiring = 0; wiring < wiring_count; ++wiring) {
+      if (!(matches[wiring] >> ops & 1)) {
+        continue;
+      }
+      PackedTree tree = packedTreeAt(ops * wiring_count + wiring);
+      struct Rational value;
+      const enum ExactStatus status =
+          evalRationalTree(tree, puzzle->numbers, all_count - 1, &value);
+      if (status == exact_overflow) {
+        ++unchecked;
+        continue;
+      }
+      if (status != exact_value || value.num != puzzle->target.exact.num ||
+          value.den != puzzle->target.exact.den) {
+        continue;
+      }
+      const uint16_t hash = canonicalSignature(tree, classes);
+      uint16_t *end = state->seenTrees + state->size,
+               *pos = upperBound(state->seenTrees, end, hash);
+      if (pos != end && *pos == hash) {
+        continue;
+      }
+      canonicalizePackedTree(&tree, classes);
+      printRealTreeImpl(out, tree, puzzle->numbers, all_count - 1);
+      putc('\n', out);
+      insert(hash, pos, state);
+    }
+  }
+  if (state->size == 0 && unchecked == 0) {
+    fputs("No solutions!\n", out);
+  }
+  return unchecked;
+}
+
+// Reads the four decimal numbers of a puzzle from stdin.
+static int solveReal(const struct RealNumber *target, double epsilon) {
+  struct RealPuzzle puzzle = {.target = *target, .epsilon = epsilon};
+  for (int i = 0; i < number_count; ++i) {
+    char word[32];
+    const int code = scanf("%31s", word);
+    if (code != 1) {
+      fprintf(stderr, "error: Input is malformed, scanf() returned %d\n",
+              code);
+      return 1;
+    }
+    if (parseDecimal(word, puzzle.numbers + i)) {
+      fprintf(stderr, "error: %s is not a decimal with at most %d places\n",
+              word, (int)real_max_scale);
+      return 1;
+    }
+  }
+  static struct NearMissHeap nearMisses;
+  struct SharedState state;
+  initSharedState(&state, &nearMisses);
+  const unsigned unchecked = solveRealPuzzle(&puzzle, &state, stdout);
+  if (unchecked) {
+    fprintf(stderr,
+            "error: %u candidate trees are too large to check exactly, so "
+            "solutions may be missing\n",
+            unchecked);
+    return 1;
+  }
+  return 0;
+}
+
+// A sweep solves every sorted quadruple with numbers in [low, high] and
+// counts how many puzzles have a given number of canonical solutions.
+// Quadruples are ranked with the combinatorial number system, applied to
+// the strictly increasing offsets a - low, b - low + 1, c - low + 2 and
+// d - low + 3 of a <= b <= c <= d. This orders all quadruples without gaps,
+// so a shard is just a range of ranks. Every puzzle visits all trees, so
+// equally sized rank ranges take equally long. That is also why sweeps don't
+// use the reachable-values cache, which would skip unsolvable puzzles.
+enum {
+  sweep_format_version = 2,
+  max_sweep_values = 1 << 16,
+  histogram_size = max_canonical_solutions + 1,
+  checkpoint_interval_seconds = 60
+};
+
+struct SweepResult {
+  int low, high;
+  uint64_t begin, end;
+  uint64_t histogram[histogram_size];
+};
+
+static uint64_t binomial(uint64_t n, unsigned k) {
+  if (n < k) {
+    return 0;
+  }
+  uint64_t result = 1;
+  for (unsigned i = 1; i <= k; ++i) {
+    result = result * (n - k + i) / i;
+  }
+  return result;
+}
+
+static uint64_t sweepSize(int low, int high) {
+  return binomial((uint64_t)(high - low) + number_count, number_count);
+}
+
+static uint64_t rankQuadruple(const int numbers[number_count], int low) {
+  uint64_t rank = 0;
+  for (unsigned i = 0; i < number_count; ++i) {
+    rank += binomial((uint64_t)(numbers[i] - low) + i, i + 1);
+  }
+  return rank;
+}
+
+static void unrankQuadruple(uint64_t rank, int low, int high,
+                            int numbers[number_count]) {
+  for (unsigned i = number_count; i-- > 0;) {
+    // Find the largest offset whose binomial doesn't exceed the rank.
+    uint64_t first = i, last = (uint64_t)(high - low) + i + 1;
+    while (last - first > 1) {
+      const uint64_t mid = first + (last - first) / 2;
+      if (binomial(mid, i + 1) <= rank) {
+        first = mid;
+      } else {
+        last = mid;
+      }
+    }
+    numbers[i] = low + (int)(first - i);
+    rank -= binomial(first, i + 1);
+  }
+}
+
+static uint64_t shardBegin(uint64_t total, unsigned shard, unsigned shards) {
+  return total / shards * shard + total % shards * shard / shards;
+}
+
+static void writeSweepResult(FILE *out, const struct SweepResult *result) {
+  fprintf(out, "game24-sweep %d\n", (int)sweep_format_version);
+  fprintf(out, "range %d %d\n", result->low, result->high);
+  fprintf(out, "ranks %" PRIu64 " %" PRIu64 "\n", result->begin, result->end);
+  for (size_t i = 0; i < histogram_size; ++i) {
+    if (result->histogram[i]) {
+      fprintf(out, "solutions %lu %" PRIu64 "\n", (unsigned long)i,
+              result->histogram[i]);
+    }
+  }
+  fputs("end\n", out);
+}
+
+// Writes a file next to path and renames it over path once it is synced, so
+// path always holds either the old or the new contents.
+static int replaceFile(const char *path, void (*write)(FILE *out,
+                                                       const void *data),
+                       const void *data) {
+  const size_t length = strlen(path);
+  char *temporary = xmalloc(length + sizeof(".tmp"));
+  memcpy(temporary, path, length);
+  memcpy(temporary + length, ".tmp", sizeof(".tmp"));
+  FILE *out = fopen(temporary, "w");
+  int ret = !out;
+  if (out) {
+    write(out, data);
+    ret = fflush(out) != 0 || fsync(fileno(out)) != 0;
+    ret = fclose(out) != 0 || ret;
+  }
+  ret = ret || rename(temporary, path) != 0;
+  if (ret) {
+    remove(temporary);
+  }
+  free(temporary);
+  return ret;
+}
+
+static void writeSweepResultData(FILE *out, const void *result) {
+  writeSweepResult(out, result);
+}
+
+// A checkpoint is the result of the ranks solved so far. It replaces the
+// previous checkpoint as a whole, so the checkpoint on disk is always
+// complete.
+static int writeCheckpoint(const char *path, const struct SweepResult *result) {
+  const int ret = replaceFile(path, writeSweepResultData, result);
+  if (ret) {
+    fprintf(stderr, "error: Can't write checkpoint %s\n", path);
+  }
+  return ret;
+}
+
+// Solves the ranks from result->end up to stop, advancing result->end as it
+// goes. With a checkpoint path, the progress is saved every
+// checkpoint_interval_seconds and once more at the end.
+static int runSweep(struct SweepResult *result, uint64_t stop,
+                    const char *checkpoint) {
+  struct NearMissHeap nearMisses = {.size = 0, .capacity = 0};
+  struct SharedState state;
+  initSharedState(&state, &nearMisses);
+  state.out = NULL;
+  const uint64_t interval = checkpoint_interval_seconds * 1000000000ull;
+  uint64_t lastCheckpoint = monotonicNanoseconds();
+  int ret = 0;
+  while (result->end != stop && ret == 0) {
+    int numbers[number_count];
+    unrankQuadruple(result->end, result->low, result->high, numbers);
+    assert(rankQuadruple(numbers, result->low) == result->end);
+    countSolutions(numbers, &state);
+    ++result->histogram[state.size];
+    ++result->end;
+    if (checkpoint &&
+        monotonicNanoseconds() - lastCheckpoint >= interval) {
+      ret = writeCheckpoint(checkpoint, result);
+      lastCheckpoint = monotonicNanoseconds();
+    }
+  }
+  return ret || (checkpoint && writeCheckpoint(checkpoint, result));
+}
+
+static bool readSweepResult(FILE *in, struct SweepResult *result) {
+  int version;
+  if (fscanf(in, "game24-sweep %d range %d %d ranks %" SCNu64 " %" SCNu64,
+             &version, &result->low, &result->high, &result->begin,
+             &result->end) != 5 ||
+      version != sweep_format_version || result->low > result->high ||
+      result->begin > result->end ||
+      result->end > sweepSize(result->low, result->high)) {
+    return false;
+  }
+  memset(result->histogram, 0, sizeof(result->histogram));
+  unsigned long solutions;
+  uint64_t puzzles;
+  while (fscanf(in, " solutions %lu %" SCNu64, &solutions, &puzzles) == 2) {
+    if (solutions >= histogram_size) {
+      return false;
+    }
+    result->histogram[solutions] += puzzles;
+  }
+  char end[4];
+  return fscanf(in, " %3s", end) == 1 && strcmp(end, "end") == 0;
+}
+
+static int compareSweepResults(const void *lhs, const void *rhs) {
+  const struct SweepResult *a = lhs, *b = rhs;
+  return a->begin < b->begin ? -1 : a->begin > b->begin;
+}
+
+// Combines shard results into the result of the whole sweep. The shards must
+// cover every rank of the sweep exactly once.
+static int mergeSweepResults(char *paths[], size_t count) {
+  struct SweepResult *results = xmalloc(sizeof(struct SweepResult) * count);
+  int ret = 0;
+  for (size_t i = 0; i < count && ret == 0; ++i) {
+    FILE *in = fopen(paths[i], "r");
+    if (!in) {
+      fprintf(stderr, "error: Can't open %s\n", paths[i]);
+      ret = 1;
+    } else if (!readSweepResult(in, results + i)) {
+      fprintf(stderr, "error: %s is not a complete sweep result\n", paths[i]);
+      ret = 1;
+    } else if (results[i].low != results[0].low ||
+               results[i].high != results[0].high) {
+      fprintf(stderr, "error: %s sweeps a different range than %s\n",
+              paths[i], paths[0]);
+      ret = 1;
+    }
+    if (in) {
+      fclose(in);
+    }
+  }
+  if (ret == 0) {
+    qsort(results, count, sizeof(struct SweepResult), compareSweepResults);
+    struct SweepResult *merged = results;
+    const uint64_t total = sweepSize(merged->low, merged->high);
+    uint64_t covered = 0;
+    for (size_t i = 0; i < count && ret == 0; ++i) {
+      if (results[i].begin > covered) {
+        fprintf(stderr, "error: Ranks %" PRIu64 " to %" PRIu64 " are missing\n",
+                covered, results[i].begin);
+        ret = 1;
+      } else if (results[i].begin < covered) {
+        fprintf(stderr, "error: Ranks %" PRIu64 " to %" PRIu64 " overlap\n",
+                results[i].begin, covered);
+        ret = 1;
+      } else if (i > 0) {
+        for (size_t j = 0; j < histogram_size; ++j) {
+          merged->histogram[j] += results[i].histogram[j];
+        }
+      }
+      covered = results[i].end;
+    }
+    if (ret == 0 && covered != total) {
+      fprintf(stderr, "error: Ranks %" PRIu64 " to %" PRIu64 " are missing\n",
+              covered, total);
+      ret = 1;
+    }
+    if (ret == 0) {
+      merged->begin = 0;
+      merged->end = total;
+      writeSweepResult(stdout, merged);
+    }
+  }
+  free(results);
+  return ret;
+}
+
+static int parseShard(const char *arg, long *shard, long *shards) {
+  char *end;
+  *shard = strtol(arg, &end, 10);
+  if (end == arg || *end != '/') {
+    return 1;
+  }
+  const char *count = end + 1;
+  *shards = strtol(count, &end, 10);
+  return end == count || *end != '\0' || *shards < 1 || *shards > 1 << 20 ||
+         *shard < 0 || *shard >= *shards;
+}
+
+static int parseSweepRange(const char *lowArg, const char *highArg, int *low,
+                           int *high) {
+  char *lowEnd, *highEnd;
+  const long lowValue = strtol(lowArg, &lowEnd, 10),
+             highValue = strtol(highArg, &highEnd, 10);
+  if (lowEnd == lowArg || *lowEnd != '\0' || highEnd == highArg ||
+      *highEnd != '\0' || lowValue > highValue || lowValue < INT_MIN ||
+      highValue > INT_MAX || highValue - lowValue >= max_sweep_values) {
+    return 1;
+  }
+  *low = lowValue;
+  *high = highValue;
+  return 0;
+}
+
+// Resumes from the checkpoint if it exists and belongs to the same shard.
+static int readCheckpoint(const char *path, struct SweepResult *result,
+                          uint64_t stop) {
+  FILE *in = fopen(path, "r");
+  if (!in) {
+    if (errno == ENOENT) {
+      return 0;
+    }
+    fprintf(stderr, "error: Can't open checkpoint %s\n", path);
+    return 1;
+  }
+  const struct SweepResult expected = *result;
+  const bool valid = readSweepResult(in, result) &&
+                     result->low == expected.low &&
+                     result->high == expected.high &&
+                     result->begin == expected.begin && result->end <= stop;
+  fclose(in);
+  if (!valid) {
+    fprintf(stderr, "error: Checkpoint %s doesn't belong to this sweep\n",
+            path);
+    return 1;
+  }
+  return 0;
+}
+
+static int sweep(int low, int high, unsigned shard, unsigned shards,
+                 const char *checkpoint) {
+  struct SweepResult *result = xmalloc(sizeof(struct SweepResult));
+  memset(result->histogram, 0, sizeof(result->histogram));
+  const uint64_t total = sweepSize(low, high);
+  result->low = low;
+  result->high = high;
+  result->begin = result->end = shardBegin(total, shard, shards);
+  const uint64_t stop = shardBegin(total, shard + 1, shards);
+  int ret = checkpoint && readCheckpoint(checkpoint, result, stop);
+  ret = ret || runSweep(result, stop, checkpoint);
+  if (ret == 0) {
+    writeSweepResult(stdout, result);
+  }
+  free(result);
+  return ret;
+}
+
+// A resumable enumeration of a puzzle's canonical solutions, for callers that
+// show them a page at a time. The cursor holds all of its state: the next
+// tree to visit and the signatures of the solutions found so far. It has no
+// pointers, so it can be saved after one page and continued for the next.
+// Version 2 numbers the trees without duplicate wirings, and version 3 signs
+// solutions by their numbers too.
+enum { cursor_format_version = 3 };
+
+struct SolutionCursor {
+  int numbers[number_count];
+  unsigned next;
+  size_t seenCount;
+  uint16_t seen[max_canonical_solutions];
+};
+
+static void openSolutionCursor(struct SolutionCursor *cursor,
+                               const int numbers[number_count]) {
+  memcpy(cursor->numbers, numbers, sizeof(cursor->numbers));
+  sortInt(cursor->numbers, cursor->numbers + number_count);
+  cursor->next = 0;
+  cursor->seenCount = 0;
+}
+
+// Stores up to count more canonical solutions in solutions, in the order
+// solvePuzzle prints them, and visits no tree past the last of them. Returns
+// how many it found; fewer than count means the puzzle has no more.
+static size_t nextSolutions(struct SolutionCursor *cursor, size_t count,
+                            PackedTree solutions[]) {
+  unsigned char classes[number_count];
+  numberClasses(cursor->numbers, classes);
+  size_t found = 0;
+  while (found < count && cursor->next < tree_count) {
+    PackedTree tree = packedTreeAt(cursor->next++);
+    const EvalResult res = evalPackedTree(tree, cursor->numbers, all_count - 1);
+    if (!res.valid || res.num != target_number) {
+      continue;
+    }
+    const uint16_t hash = canonicalSignature(tree, classes);
+    uint16_t *end = cursor->seen + cursor->seenCount,
+             *pos = upperBound(cursor->seen, end, hash);
+    if (pos != end && *pos == hash) {
+      continue;
+    }
+    assert(cursor->seenCount < max_canonical_solutions);
+    memmove(pos + 1, pos, (end - pos) * sizeof(uint16_t));
+    *pos = hash;
+    ++cursor->seenCount;
+    canonicalizePackedTree(&tree, classes);
+    solutions[found++] = tree;
+  }
+  return found;
+}
+
+static void writeSolutionCursor(FILE *out, const void *data) {
+  const struct SolutionCursor *cursor = data;
+  fprintf(out, "game24-cursor %d\n", (int)cursor_format_version);
+  fprintf(out, "numbers %d %d %d %d\n", cursor->numbers[0], cursor->numbers[1],
+          cursor->numbers[2], cursor->numbers[3]);
+  fprintf(out, "next %u\n", cursor->next);
+  fprintf(out, "seen %lu", (unsigned long)cursor->seenCount);
+  for (size_t i = 0; i < cursor->seenCount; ++i) {
+    fprintf(out, " %u", (unsigned)cursor->seen[i]);
+  }
+  fputs("\nend\n", out);
+}
+
+static bool readSolutionCursor(FILE *in, struct SolutionCursor *cursor) {
+  int version;
+  unsigned long seenCount;
+  if (fscanf(in, "game24-cursor %d numbers %d %d %d %d next %u seen %lu",
+             &version, cursor->numbers, cursor->numbers + 1,
+             cursor->numbers + 2, cursor->numbers + 3, &cursor->next,
+             &seenCount) != 7 ||
+      version != cursor_format_version || cursor->next > tree_count ||
+      seenCount > max_canonical_solutions) {
+    return false;
+  }
+  for (int i = 1; i < number_count; ++i) {
+    if (cursor->numbers[i] < cursor->numbers[i - 1]) {
+      return false;
+    }
+  }
+  cursor->seenCount = seenCount;
+  for (size_t i = 0; i < cursor->seenCount; ++i) {
+    unsigned hash;
+    if (fscanf(in, "%u", &hash) != 1 || hash > UINT16_MAX ||
+        (i > 0 && hash <= cursor->seen[i - 1])) {
+      return false;
+    }
+    cursor->seen[i] = hash;
+  }
+  char end[4];
+  return fscanf(in, " %3s", end) == 1 && strcmp(end, "end") == 0;
+}
+
+// Prints the next page of solutions. With a cursor path the puzzle continues
+// from the saved cursor, or is read from stdin if there is none yet, and the
+// cursor is saved again afterwards.
+static int printPage(size_t count, const char *path) {
+  struct SolutionCursor cursor;
+  FILE *in = path ? fopen(path, "r") : NULL;
+  if (in) {
+    const bool valid = readSolutionCursor(in, &cursor);
+    fclose(in);
+    if (!valid) {
+      fprintf(stderr, "error: %s is not a solution cursor\n", path);
+      return 1;
+    }
+  } else if (path && errno != ENOENT) {
+    fprintf(stderr, "error: Can't open cursor %s\n", path);
+    return 1;
+  } else {
+    int numbers[number_count];
+    for (int i = 0; i < number_count; ++i) {
+      const int code = scanf("%d", numbers + i);
+      if (code != 1) {
+        fprintf(stderr, "error: Input is malformed, scanf() returned %d\n",
+                code);
+        return 1;
+      }
+    }
+    openSolutionCursor(&cursor, numbers);
+  }
+  PackedTree *solutions = xmalloc(sizeof(PackedTree) * count);
+  const size_t found = nextSolutions(&cursor, count, solutions);
+  for (size_t i = 0; i < found; ++i) {
+    printPackedTree(stdout, solutions[i], cursor.numbers);
+  }
+  if (cursor.seenCount == 0) {
+    fputs("No solutions!\n", stdout);
+  }
+  free(solutions);
+  if (path && replaceFile(path, writeSolutionCursor, &cursor)) {
+    fprintf(stderr, "error: Can't write cursor %s\n", path);
+    return 1;
+  }
+  return 0;
+}
+
+// A generator samples puzzles that match a difficulty profile. A one-time
+// sweep records the features of every sorted quadruple in [low, high], by
+// rank: the number of canonical solutions, the operators every one of them
+// uses and the first of them. The features can be saved to an index file,
+// so later runs over the same range skip the sweep. The quadruples matching
+// a profile are collected into a candidate array once, after which each
+// puzzle is a single uniformly random pick.
+enum { index_format_version = 2, max_generator_puzzles = 1 << 22 };
+
+struct PuzzleFeatures {
+  PackedTree solution;
+  uint16_t solutions;
+  unsigned char required;
+};
+
+// Puzzles with between minSolutions and maxSolutions canonical solutions,
+// all of which use every operator in required.
+struct DifficultyProfile {
+  uint16_t minSolutions, maxSolutions;
+  unsigned char required;
+};
+
+struct GeneratorCandidate {
+  int numbers[number_count];
+  PackedTree solution;
+};
+
+// The numbers must be sorted. Unsolvable puzzles require no operators.
+static void computeFeatures(const int numbers[number_count],
+                            struct ReachableCache *reachable,
+                            struct PuzzleFeatures *features) {
+  *features = (struct PuzzleFeatures){
+      .solution = 0, .solutions = 0, .required = 0};
+  if (reachable && !maySolve(reachable, numbers)) {
+    return;
+  }
+  struct SolutionCursor cursor;
+  PackedTree solutions[max_canonical_solutions];
+  openSolutionCursor(&cursor, numbers);
+  const size_t found =
+      nextSolutions(&cursor, max_canonical_solutions, solutions);
+  if (found == 0) {
+    return;
+  }
+  features->solution = solutions[0];
+  features->solutions = found;
+  features->required = 0xf;
+  for (size_t i = 0; i < found; ++i) {
+    features->required &= usedOperators(solutions[i]);
+  }
+}
+
+static void sweepFeatures(int low, int high, struct PuzzleFeatures features[],
+                          struct ReachableCache *reachable) {
+  const uint64_t total = sweepSize(low, high);
+  for (uint64_t rank = 0; rank < total; ++rank) {
+    int numbers[number_count];
+    unrankQuadruple(rank, low, high, numbers);
+    computeFeatures(numbers, reachable, features + rank);
+  }
+}
+
+struct FeatureIndex {
+  int low, high;
+  struct PuzzleFeatures *features;
+};
+
+static void writeFeatureIndex(FILE *out, const void *data) {
+  const struct FeatureIndex *index = data;
+  const uint64_t total = sweepSize(index->low, index->high);
+  fprintf(out, "game24-index %d\n", (int)index_format_version);
+  fprintf(out, "range %d %d\n", index->low, index->high);
+  for (uint64_t rank = 0; rank < total; ++rank) {
+    const struct PuzzleFeatures *features = index->features + rank;
+    fprintf(out, "%u %x %" PRIx64 "\n", (unsigned)features->solutions,
+            (unsigned)features->required, features->solution);
+  }
+  fputs("end\n", out);
+}
+
+// Reads the features of index->low to index->high. Fails if the file was
+// written for another range.
+static bool readFeatureIndex(FILE *in, struct FeatureIndex *index) {
+  int version, low, high;
+  if (fscanf(in, "game24-index %d range %d %d", &version, &low, &high) != 3 ||
+      version != index_format_version || low != index->low ||
+      high != index->high) {
+    return false;
+  }
+  const uint64_t total = sweepSize(low, high);
+  for (uint64_t rank = 0; rank < total; ++rank) {
+    unsigned solutions, required;
+    PackedTree solution;
+    if (fscanf(in, "%u %x %" SCNx64, &solutions, &required, &solution) != 3 ||
+        solutions > max_canonical_solutions || required > 0xf ||
+        (solutions == 0) != (solution == 0)) {
+      return false;
+    }
+    index->features[rank] = (struct PuzzleFeatures){
+        .solution = solution, .solutions = solutions, .required = required};
+  }
+  char end[4];
+  return fscanf(in, " %3s", end) == 1 && strcmp(end, "end") == 0;
+}
+
+// Loads the features from path if it exists, and otherwise sweeps them and
+// saves them there.
+static int loadFeatures(struct FeatureIndex *index, const char *path,
+                        struct ReachableCache *reachable) {
+  FILE *in = path ? fopen(path, "r") : NULL;
+  if (in) {
+    const bool valid = readFeatureIndex(in, index);
+    fclose(in);
+    if (!valid) {
+      fprintf(stderr, "error: %s is not an index of %d to %d\n", path,
+              index->low, index->high);
+      return 1;
+    }
+    return 0;
+  }
+  if (path && errno != ENOENT) {
+    fprintf(stderr, "error: Can't open index %s\n", path);
+    return 1;
+  }
+  sweepFeatures(index->low, index->high, index->features, reachable);
+  if (path && replaceFile(path, writeFeatureIndex, index)) {
+    fprintf(stderr, "error: Can't write index %s\n", path);
+    return 1;
+  }
+  return 0;
+}
+
+static bool matchesProfile(const struct PuzzleFeatures *features,
+                           const struct DifficultyProfile *profile) {
+  return features->solutions >= profile->minSolutions &&
+         features->solutions <= profile->maxSolutions &&
+         (profile->required & ~features->required) == 0;
+}
+
+// Stores the puzzles of the index that match the profile in candidates and
+// returns how many there are.
+static size_t collectCandidates(const struct FeatureIndex *index,
+                                const struct DifficultyProfile *profile,
+                                struct GeneratorCandidate candidates[]) {
+  const uint64_t total = sweepSize(index->low, index->high);
+  size_t count = 0;
+  for (uint64_t rank = 0; rank < total; ++rank) {
+    const struct PuzzleFeatures *features = index->features + rank;
+    if (matchesProfile(features, profile)) {
+      struct GeneratorCandidate *candidate = candidates + count++;
+      unrankQuadruple(rank, index->low, index->high, candidate->numbers);
+      candidate->solution = features->solution;
+    }
+  }
+  return count;
+}
+
+// SplitMix64, which passes BigCrush and accepts any seed.
+static uint64_t nextRandom(uint64_t *state) {
+  uint64_t z = *state += 0x9e3779b97f4a7c15u;
+  z = (z ^ z >> 30) * 0xbf58476d1ce4e5b9u;
+  z = (z ^ z >> 27) * 0x94d049bb133111ebu;
+  return z ^ z >> 31;
+}
+
+// Returns a uniformly distributed number below bound without a division in
+// the common case, by Lemire's multiply and reject method.
+static uint32_t randomBelow(uint64_t *state, uint32_t bound) {
+  uint64_t product = (nextRandom(state) >> 32) * bound;
+  if ((uint32_t)product < bound) {
+    const uint32_t threshold = -bound % bound;
+    while ((uint32_t)product < threshold) {
+      product = (nextRandom(state) >> 32) * bound;
+    }
+  }
+  return product >> 32;
+}
+
+// Prints count puzzles as "a b c d: solution", the format --verify reads.
+// Puzzles without solutions are printed without one.
+static int generatePuzzles(long count, int low, int high,
+                           const struct DifficultyProfile *profile,
+                           uint64_t seed, const char *path,
+                           enum OutputFormat format,
+                           struct ReachableCache *reachable) {
+  const uint64_t total = sweepSize(low, high);
+  if (total > max_generator_puzzles) {
+    fprintf(stderr, "error: %d to %d has more than %d puzzles\n", low, high,
+            (int)max_generator_puzzles);
+    return 1;
+  }
+  struct FeatureIndex index = {
+      .low = low,
+      .high = high,
+      .features = xmalloc(sizeof(struct PuzzleFeatures) * total)};
+  struct GeneratorCandidate *candidates = NULL;
+  int ret = loadFeatures(&index, path, reachable);
+  size_t candidateCount = 0;
+  if (ret == 0) {
+    candidates = xmalloc(sizeof(struct GeneratorCandidate) * total);
+    candidateCount = collectCandidates(&index, profile, candidates);
+    if (candidateCount == 0) {
+      fprintf(stderr, "error: No puzzle with numbers in %d to %d matches\n",
+              low, high);
+      ret = 1;
+    }
+  }
+  struct TemplateCache templates;
+  initTemplateCache(&templates, format);
+  for (long i = 0; i < count && ret == 0; ++i) {
+    const struct GeneratorCandidate *candidate =
+        candidates + randomBelow(&seed, candidateCount);
+    char line[number_count * 12 + 1 + template_line_size];
+    size_t size = 0;
+    for (unsigned j = 0; j < number_count; ++j) {
+      char digits[11], *const end = digits + sizeof(digits);
+      const char *first = formatInt(candidate->numbers[j], end);
+      memcpy(line + size, first, end - first);
+      size += end - first;
+      line[size++] = j + 1 < number_count ? ' ' : ':';
+    }
+    if (candidate->solution) {
+      line[size++] = ' ';
+      size += renderTree(&templates, candidate->solution, candidate->numbers,
+                         line + size);
+    } else {
+      --size;
+    }
+    line[size++] = '\n';
+    fwrite(line, 1, size, stdout);
+  }
+  free(candidates);
+  free(index.features);
+  return ret;
+}
+
+// The numbers game: reach a target from up to eight numbers with all four
+// operators, not necessarily using every number. Intermediate results must
+// be positive integers. Enumerating trees does not scale to six numbers, so
+// the search repeatedly replaces a pair of the remaining values by their
+// result, depth first.
+enum {
+  countdown_number_count = 8,
+  countdown_node_count = 2 * countdown_number_count - 1,
+  // Multisets of at least this many values are remembered once explored.
+  countdown_memo_min = 3,
+  countdown_memo_bits = 15,
+  countdown_memo_size = 1 << countdown_memo_bits,
+  // Searches with a deadline read the clock once per this many multisets.
+  countdown_clock_interval = 256
+};
+
+struct CountdownValue {
+  int64_t value;
+  unsigned char node;
+};
+
+struct CountdownMemoEntry {
+  uint32_t generation;
+  unsigned char count;
+  int64_t values[countdown_number_count - 1];
+};
+
+// No result exceeds the product of the numbers, counting ones as twos, so
+// limiting that product rules out overflows.
+static const int64_t countdown_max_product = INT64_C(1000000000000000000);
+
+struct CountdownSearch {
+  int64_t target;
+  unsigned char numberCount;
+  // Parallel searches give up once a task before theirs hit the target.
+  const size_t *firstHit;
+  size_t task;
+  // A search stops once the monotonic clock passes a nonzero deadline and
+  // keeps the best expression so far. progress is then the fraction of the
+  // search that was done, weighting the branches of each multiset equally.
+  uint64_t deadline;
+  unsigned untilClockCheck;
+  bool timedOut;
+  double progress;
+  // Numbers come first, then one operator per reduction.
+  struct Node nodes[countdown_node_count];
+  int64_t bestValue;
+  uint64_t bestDistance;
+  unsigned char bestRoot;
+  struct Node bestNodes[countdown_node_count];
+  uint32_t generation;
+  struct CountdownMemoEntry memo[countdown_memo_size];
+};
+
+static uint64_t absDifference(int64_t a, int64_t b) {
+  return a > b ? (uint64_t)(a - b) : (uint64_t)(b - a);
+}
+
+// Returns false if the multiset was explored before. values are sorted. The
+// memo is direct mapped: a multiset replaces whatever shared its entry, which
+// only means that the other one may be explored again.
+static bool rememberCountdownValues(struct CountdownSearch *search,
+                                    const struct CountdownValue values[],
+                                    size_t count) {
+  uint64_t hash = count;
+  for (size_t i = 0; i < count; ++i) {
+    hash = (hash ^ (uint64_t)values[i].value) * UINT64_C(0x9e3779b97f4a7c15);
+  }
+  struct CountdownMemoEntry *entry =
+      search->memo + (hash >> (64 - countdown_memo_bits));
+  if (entry->generation == search->generation && entry->count == count) {
+    size_t i = 0;
+    while (i < count && entry->values[i] == values[i].value) {
+      ++i;
+    }
+    if (i == count) {
+      return false;
+    }
+  }
+  entry->generation = search->generation;
+  entry->count = count;
+  for (size_t i = 0; i < count; ++i) {
+    entry->values[i] = values[i].value;
+  }
+  return true;
+}
+
+// Operands are ordered larger first, so every commutative operation and
+// every subtraction or division is only tried once. Operations that leave an
+// operand unchanged or give back the other operand are useless: the
+// remaining numbers don't have to be used anyway.
+static bool reduceCountdownPair(int64_t a, int64_t b, enum OperatorKind kind,
+                                int64_t *result) {
+  assert(a >= b && b > 0);
+  switch (kind) {
+  case op_add:
+    *result = a + b;
+    return true;
+  case op_sub:
+    *result = a - b;
+    return a > b && *result != b;
+  case op_mul:
+    *result = a * b;
+    return b != 1;
+  case op_div:
+    if (b == 1) {
+      return false;
+    }
+    // Most values fit 32 bits, where division is a lot cheaper.
+    if (a <= UINT32_MAX) {
+      *result = (uint32_t)a / (uint32_t)b;
+      return (uint32_t)a % (uint32_t)b == 0 && *result != b;
+    }
+    *result = a / b;
+    return a % b == 0 && *result != b;
+  }
+  CANT_REACH
+}
+
+// No result exceeds the product of the values, counting ones as twos. Returns
+// false if even that can't get closer to the target.
+static bool countdownMayImprove(const struct CountdownSearch *search,
+                                const struct CountdownValue values[],
+                                size_t count) {
+  int64_t largest = 1;
+  for (size_t i = 0; i < count; ++i) {
+    largest *= values[i].value == 1 ? 2 : values[i].value;
+  }
+  return largest + (int64_t)search->bestDistance > search->target;
+}
+
+static bool searchCountdown(struct CountdownSearch *search,
+                            const struct CountdownValue values[],
+                            size_t count);
+
+static bool countdownInTime(struct CountdownSearch *search) {
+  if (!search->timedOut && --search->untilClockCheck == 0) {
+    search->untilClockCheck = countdown_clock_interval;
+    search->timedOut = monotonicNanoseconds() >= search->deadline;
+    if (search->timedOut) {
+      search->progress = 0;
+    }
+  }
+  return !search->timedOut;
+}
+
+// Replaces values[i] and values[j] by their result under kind, given the
+// remaining values in rest, and searches on. Returns true once the target is
+// reached.
+static bool reduceCountdown(struct CountdownSearch *search,
+                            const struct CountdownValue values[], size_t count,
+                            size_t i, size_t j, enum OperatorKind kind,
+                            int64_t result, const struct CountdownValue rest[]) {
+  const size_t restCount = count - 2;
+  const bool closer =
+      absDifference(result, search->target) < search->bestDistance;
+  const unsigned char node = 2 * search->numberCount - count;
+  search->nodes[node] = (struct Node){
+      .kind = node_operator,
+      .v.op = {.kind = kind, .lhs = values[i].node, .rhs = values[j].node}};
+  if (closer) {
+    search->bestValue = result;
+    search->bestDistance = absDifference(result, search->target);
+    search->bestRoot = node;
+    memcpy(search->bestNodes, search->nodes, sizeof(search->nodes));
+    if (result == search->target) {
+      return true;
+    }
+  }
+  if (restCount == 0) {
+    return false;
+  }
+  struct CountdownValue reduced[countdown_number_count];
+  size_t pos = 0;
+  for (; pos < restCount && rest[pos].value >= result; ++pos) {
+    reduced[pos] = rest[pos];
+  }
+  reduced[pos] = (struct CountdownValue){result, node};
+  memcpy(reduced + pos + 1, rest + pos, sizeof(*rest) * (restCount - pos));
+  return searchCountdown(search, reduced, restCount + 1);
+}
+
+// Collects the values other than values[i] and values[j] in order. Returns
+// false if the pair only repeats an earlier one because of equal values.
+static bool countdownPair(const struct CountdownValue values[], size_t count,
+                          size_t i, size_t j, struct CountdownValue rest[]) {
+  if ((i > 0 && values[i].value == values[i - 1].value) ||
+      (j > i + 1 && values[j].value == values[j - 1].value)) {
+    return false;
+  }
+  for (size_t k = 0, restCount = 0; k < count; ++k) {
+    if (k != i && k != j) {
+      rest[restCount++] = values[k];
+    }
+  }
+  return true;
+}
+
+// values are sorted in descending order. Returns true once the target is
+// reached.
+static bool searchCountdown(struct CountdownSearch *search,
+                            const struct CountdownValue values[],
+                            size_t count) {
+  if (search->firstHit &&
+      RELAXED_LOAD(search->firstHit) < search->task) {
+    return false;
+  }
+  if (search->deadline && !countdownInTime(search)) {
+    return false;
+  }
+  if (count >= countdown_memo_min &&
+      !rememberCountdownValues(search, values, count)) {
+    return false;
+  }
+  if (!countdownMayImprove(search, values, count)) {
+    return false;
+  }
+  struct CountdownValue rest[countdown_number_count];
+  size_t branch = 0;
+  for (size_t i = 0; i + 1 < count; ++i) {
+    for (size_t j = i + 1; j < count; ++j, branch += 4) {
+      if (!countdownPair(values, count, i, j, rest)) {
+        continue;
+      }
+      for (enum OperatorKind kind = op_add; kind <= op_div; ++kind) {
+        int64_t result;
+        if (!reduceCountdownPair(values[i].value, values[j].value, kind,
+                                 &result)) {
+          continue;
+        }
+        // The last pair only matters if it gets closer.
+        if (count == 2 &&
+            absDifference(result, search->target) >= search->bestDistance) {
+          continue;
+        }
+        if (reduceCountdown(search, values, count, i, j, kind, result,
+                            rest)) {
+          return true;
+        }
+        if (search->timedOut) {
+          search->progress = (branch + kind + search->progress) /
+                             (count * (count - 1) / 2 * 4);
+          return false;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+static void forgetCountdownValues(struct CountdownSearch *search) {
+  // Generation 0 marks empty memo entries.
+  if (++search->generation == 0) {
+    memset(search->memo, 0, sizeof(search->memo));
+    search->generation = 1;
+  }
+}
+
+// Sets up a search for the numbers and fills values with them in descending
+// order. The closest number is the best expression so far.
+static void startCountdown(struct CountdownSearch *search,
+                           const int numbers[], unsigned char count,
+                           int target, struct CountdownValue values[]) {
+  assert(count > 0 && count <= countdown_number_count);
+  search->target = target;
+  search->numberCount = count;
+  search->firstHit = NULL;
+  search->task = 0;
+  search->untilClockCheck = countdown_clock_interval;
+  search->timedOut = false;
+  search->progress = 1;
+  forgetCountdownValues(search);
+  for (unsigned char i = 0; i < count; ++i) {
+    search->nodes[i] = (struct Node){.kind = node_number, .v.n = numbers[i]};
+    size_t pos = i;
+    for (; pos > 0 && values[pos - 1].value < numbers[i]; --pos) {
+      values[pos] = values[pos - 1];
+    }
+    values[pos] = (struct CountdownValue){numbers[i], i};
+  }
+  search->bestValue = values[0].value;
+  search->bestRoot = values[0].node;
+  for (unsigned char i = 1; i < count; ++i) {
+    if (absDifference(values[i].value, target) <
+        absDifference(search->bestValue, target)) {
+      search->bestValue = values[i].value;
+      search->bestRoot = values[i].node;
+    }
+  }
+  search->bestDistance = absDifference(search->bestValue, target);
+  memcpy(search->bestNodes, search->nodes, sizeof(search->nodes));
+}
+
+static void initCountdownSearch(struct CountdownSearch *search) {
+  search->deadline = 0;
+  search->generation = 0;
+  memset(search->memo, 0, sizeof(search->memo));
+}
+
+// Leaves the expression closest to the target in search->bestNodes. Returns
+// whether it reaches the target. Unless the target is reached, the
+// expression is only the closest one if search->timedOut is false.
+static bool solveCountdown(struct CountdownSearch *search, const int numbers[],
+                           unsigned char count, int target) {
+  struct CountdownValue values[countdown_number_count];
+  startCountdown(search, numbers, count, target, values);
+  return search->bestValue == target || searchCountdown(search, values, count);
+}
+
+#ifdef HAVE_ATOMICS
+// The first reductions of a search are independent tasks, numbered in the
+// order the serial search tries them. Every worker owns a range of tasks,
+// packed as begin << 32 | end, takes tasks from its front and, once it runs
+// out, steals the back half of another worker's range. Each task starts from
+// the best expression of the initial numbers. A worker keeps its memo from
+// one task to the next only if the next task comes later and the previous
+// one was fully explored without a hit, so the memo holds just what the
+// serial search would already have explored.
+//
+// A hit cancels every later task but none before it, and the outcomes are
+// merged in task order. This reproduces the serial result exactly: skipping
+// a multiset explored earlier never skips the first expression closest to
+// the target, and ties are won by the earliest expression either way.
+enum { countdown_max_tasks = countdown_number_count *
+                             (countdown_number_count - 1) / 2 * 4 };
+
+struct CountdownTask {
+  int64_t result;
+  unsigned char i, j;
+  enum OperatorKind kind;
+};
+
+struct CountdownOutcome {
+  // The fraction of the task that was searched.
+  double progress;
+  int64_t bestValue;
+  uint64_t bestDistance;
+  unsigned char bestRoot;
+  struct Node bestNodes[countdown_node_count];
+};
+
+struct CountdownPool {
+  const struct CountdownSearch *start;
+  const struct CountdownValue *values;
+  struct CountdownTask tasks[countdown_max_tasks];
+  struct CountdownOutcome outcomes[countdown_max_tasks];
+  size_t taskCount, firstHit;
+  bool timedOut;
+  uint64_t *ranges;
+  unsigned workers, nextWorker;
+};
+
+static bool popCountdownTask(uint64_t *range, size_t *task) {
+  uint64_t current = ATOMIC_LOAD(range);
+  for (;;) {
+    const uint64_t begin = current >> 32, end = current & UINT32_MAX;
+    if (begin >= end) {
+      return false;
+    }
+    if (ATOMIC_COMPARE_EXCHANGE(range, &current, (begin + 1) << 32 | end)) {
+      *task = begin;
+      return true;
+    }
+  }
+}
+
+// Moves the back half of some other worker's tasks to the empty range of
+// the thief.
+static bool stealCountdownTasks(struct CountdownPool *pool, unsigned thief) {
+  for (unsigned offset = 1; offset < pool->workers; ++offset) {
+    uint64_t *victim = pool->ranges + (thief + offset) % pool->workers;
+    uint64_t current = ATOMIC_LOAD(victim);
+    for (;;) {
+      const uint64_t begin = current >> 32, end = current & UINT32_MAX;
+      if (begin >= end) {
+        break;
+      }
+      const uint64_t middle = end - (end - begin + 1) / 2;
+      if (ATOMIC_COMPARE_EXCHANGE(victim, &current, begin << 32 | middle)) {
+        ATOMIC_STORE(pool->ranges + thief, middle << 32 | end);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Returns whether the task was fully explored without a hit.
+static bool runCountdownTask(struct CountdownPool *pool,
+                             struct CountdownSearch *search, size_t task,
+                             bool keepMemo) {
+  const struct CountdownSearch *start = pool->start;
+  const struct CountdownTask *current = pool->tasks + task;
+  search->task = task;
+  if (!keepMemo) {
+    forgetCountdownValues(search);
+  }
+  search->bestValue = start->bestValue;
+  search->bestDistance = start->bestDistance;
+  search->bestRoot = start->bestRoot;
+  memcpy(search->bestNodes, start->bestNodes, sizeof(search->bestNodes));
+  struct CountdownValue rest[countdown_number_count];
+  const size_t count = start->numberCount;
+  countdownPair(pool->values, count, current->i, current->j, rest);
+  const bool hit =
+      reduceCountdown(search, pool->values, count, current->i, current->j,
+                      current->kind, current->result, rest);
+  struct CountdownOutcome *outcome = pool->outcomes + task;
+  outcome->progress = search->timedOut ? search->progress : 1;
+  outcome->bestValue = search->bestValue;
+  outcome->bestDistance = search->bestDistance;
+  outcome->bestRoot = search->bestRoot;
+  memcpy(outcome->bestNodes, search->bestNodes, sizeof(outcome->bestNodes));
+  if (!hit) {
+    return !search->timedOut && RELAXED_LOAD(&pool->firstHit) > task;
+  }
+  size_t firstHit = ATOMIC_LOAD(&pool->firstHit);
+  while (task < firstHit &&
+         !ATOMIC_COMPARE_EXCHANGE(&pool->firstHit, &firstHit, task)) {
+  }
+  return false;
+}
+
+static void *countdownWorker(void *data) {
+  struct CountdownPool *pool = data;
+  const unsigned worker = ATOMIC_FETCH_ADD(&pool->nextWorker, 1);
+  struct CountdownSearch *search = xmalloc(sizeof(struct CountdownSearch));
+  initCountdownSearch(search);
+  const struct CountdownSearch *start = pool->start;
+  search->target = start->target;
+  search->numberCount = start->numberCount;
+  search->firstHit = &pool->firstHit;
+  search->deadline = start->deadline;
+  search->untilClockCheck = countdown_clock_interval;
+  search->timedOut = false;
+  memcpy(search->nodes, start->nodes, sizeof(search->nodes));
+  bool explored = false;
+  size_t previous = 0;
+  do {
+    size_t task;
+    while (!search->timedOut &&
+           popCountdownTask(pool->ranges + worker, &task)) {
+      if (task < RELAXED_LOAD(&pool->firstHit)) {
+        explored = runCountdownTask(pool, search, task,
+                                    explored && task > previous);
+        previous = task;
+      }
+    }
+  } while (!search->timedOut && stealCountdownTasks(pool, worker));
+  if (search->timedOut) {
+    RELAXED_STORE(&pool->timedOut, true);
+  }
+  free(search);
+  return NULL;
+}
+
+// Like solveCountdown, but the first reductions are searched by a pool of
+// workers. A worker that runs out of time takes no further tasks, so the
+// progress of a search that timed out counts the tasks nobody started as
+// not searched at all.
+static bool solveCountdownParallel(struct CountdownSearch *search,
+                                   const int numbers[], unsigned char count,
+                                   int target, unsigned workers) {
+  struct CountdownValue values[countdown_number_count];
+  startCountdown(search, numbers, count, target, values);
+  if (search->bestValue == target) {
+    return true;
+  }
+  if (workers < 2 || count < countdown_memo_min ||
+      !countdownMayImprove(search, values, count)) {
+    return searchCountdown(search, values, count);
+  }
+  struct CountdownPool *pool = xmalloc(sizeof(struct CountdownPool));
+  pool->start = search;
+  pool->values = values;
+  pool->taskCount = 0;
+  struct CountdownValue rest[countdown_number_count];
+  for (size_t i = 0; i + 1 < count; ++i) {
+    for (size_t j = i + 1; j < count; ++j) {
+      if (!countdownPair(values, count, i, j, rest)) {
+        continue;
+      }
+      for (enum OperatorKind kind = op_add; kind <= op_div; ++kind) {
+        int64_t result;
+        if (reduceCountdownPair(values[i].value, values[j].value, kind,
+                                &result)) {
+          pool->tasks[pool->taskCount++] = (struct CountdownTask){
+              .result = result, .i = i, .j = j, .kind = kind};
+        }
+      }
+    }
+  }
+  pool->firstHit = pool->taskCount;
+  pool->timedOut = false;
+  for (size_t task = 0; task < pool->taskCount; ++task) {
+    pool->outcomes[task].progress = 0;
+    pool->outcomes[task].bestDistance = UINT64_MAX;
+  }
+  pool->workers = workers;
+  pool->nextWorker = 0;
+  pool->ranges = xmalloc(sizeof(uint64_t) * workers);
+  for (unsigned i = 0; i < workers; ++i) {
+    pool->ranges[i] = (uint64_t)shardBegin(pool->taskCount, i, workers) << 32 |
+                      shardBegin(pool->taskCount, i + 1, workers);
+  }
+  pthread_t *threads = xmalloc(sizeof(pthread_t) * workers);
+  for (unsigned i = 0; i < workers; ++i) {
+    pthread_create(threads + i, NULL, countdownWorker, pool);
+  }
+  for (unsigned i = 0; i < workers; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+
+  const bool hit = pool->firstHit < pool->taskCount;
+  const struct CountdownOutcome *best = hit ? pool->outcomes + pool->firstHit
+                                            : NULL;
+  for (size_t task = 0; !hit && task < pool->taskCount; ++task) {
+    if (pool->outcomes[task].bestDistance <
+        (best ? best->bestDistance : search->bestDistance)) {
+      best = pool->outcomes + task;
+    }
+  }
+  search->timedOut = pool->timedOut;
+  if (search->timedOut) {
+    double done = 0;
+    for (size_t task = 0; task < pool->taskCount; ++task) {
+      done += pool->outcomes[task].progress;
+    }
+    search->progress = done / pool->taskCount;
+  }
+  if (best) {
+    search->bestValue = best->bestValue;
+    search->bestDistance = best->bestDistance;
+    search->bestRoot = best->bestRoot;
+    memcpy(search->bestNodes, best->bestNodes, sizeof(search->bestNodes));
+  }
+  free(threads);
+  free(pool->ranges);
+  free(pool);
+  return hit;
+}
+#endif
+
+static void printCountdownNode(FILE *out, const struct Node nodes[],
+                               unsigned char idx) {
+  const struct Node *node = nodes + idx;
+  switch (node->kind) {
+  case node_number:
+    fprintf(out, "%d", node->v.n);
+    break;
+  case node_operator:
+    putc('(', out);
+    printCountdownNode(out, nodes, node->v.op.lhs);
+    fprintf(out, " %c ", opChars[node->v.op.kind]);
+    printCountdownNode(out, nodes, node->v.op.rhs);
+    putc(')', out);
+  }
+}
+
+// Reads the numbers followed by the target. With a budget in milliseconds
+// the search gives up on finding the closest expression once it runs out,
+// and says how much of the search it did.
+static int countdown(unsigned threads, long budget) {
+  int numbers[countdown_number_count + 1];
+  int count = 0, code;
+  while (count <= countdown_number_count &&
+         (code = scanf("%d", numbers + count)) == 1) {
+    if (numbers[count++] < 1) {
+      fprintf(stderr, "error: %d is not positive\n", numbers[count - 1]);
+      return 1;
+    }
+  }
+  if (count <= countdown_number_count && code != EOF) {
+    fprintf(stderr, "error: Input is malformed, scanf() returned %d\n", code);
+    return 1;
+  }
+  if (count < 2 || scanf("%d", &code) == 1) {
+    fprintf(stderr, "error: Expected 1 to %d numbers and a target\n",
+            (int)countdown_number_count);
+    return 1;
+  }
+  const int target = numbers[--count];
+  int64_t product = 1;
+  for (int i = 0; i < count; ++i) {
+    const int64_t factor = numbers[i] == 1 ? 2 : numbers[i];
+    if (product > countdown_max_product / factor) {
+      fputs("error: The numbers are too large\n", stderr);
+      return 1;
+    }
+    product *= factor;
+  }
+  struct CountdownSearch *search = xmalloc(sizeof(struct CountdownSearch));
+  initCountdownSearch(search);
+  if (budget) {
+    search->deadline = monotonicNanoseconds() + (uint64_t)budget * 1000000u;
+  }
+#ifdef HAVE_ATOMICS
+  const bool solved =
+      threads > 1
+          ? solveCountdownParallel(search, numbers, count, target, threads)
+          : solveCountdown(search, numbers, count, target);
+#else
+  (void)threads;
+  const bool solved = solveCountdown(search, numbers, count, target);
+#endif
+  if (!solved && search->timedOut) {
+    printf("Deadline reached with %.1f%% searched\n", search->progress * 100);
+  } else if (!solved) {
+    fputs("No solutions!\n", stdout);
+  }
+  printCountdownNode(stdout, search->bestNodes, search->bestRoot);
+  if (solved) {
+    putchar('\n');
+  } else {
+    printf(" = %" PRId64 "\n", search->bestValue);
+  }
+  free(search);
+  return 0;
+}
+
+static int parseCount(const char *arg, long max, long *count) {
+  char *end;
+  const long value = strtol(arg, &end, 10);
+  if (*arg == '\0' || *end != '\0' || value < 1 || value > max) {
+    return 1;
+  }
+  *count = value;
+  return 0;
+}
+
+// Parses a set of operators such as "+-*" into a mask of OperatorKinds.
+static int parseOperators(const char *arg, unsigned char *mask) {
+  *mask = 0;
+  for (; *arg; ++arg) {
+    const char *op = memchr(opChars, *arg, sizeof(opChars));
+    if (!op) {
+      return 1;
+    }
+    *mask |= 1u << (op - opChars);
+  }
+  return 0;
+}
+
+// Parses "n" or "min-max" into the solution counts of the profile.
+static int parseSolutionRange(const char *arg,
+                              struct DifficultyProfile *profile) {
+  char *end;
+  const long min = strtol(arg, &end, 10);
+  long max = min;
+  if (end != arg && *end == '-') {
+    const char *second = end + 1;
+    max = strtol(second, &end, 10);
+    if (end == second) {
+      return 1;
+    }
+  }
+  if (end == arg || *end != '\0' || min < 0 || min > max ||
+      max > max_canonical_solutions) {
+    return 1;
+  }
+  profile->minSolutions = min;
+  profile->maxSolutions = max;
+  return 0;
+}
+
+static NORETURN void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [-k count] [--format full|minimal|rpn] "
+          "[--operators ops] [--require ops]\n"
+          "           [--max-depth n] [--left-deep] [--trace file] "
+          "[--features]\n"
+          "           [-b [-j threads] [--latency text|json] "
+          "[--cache-stats] [file]]\n"
+          "       %s --sweep low high [--shard index/count] "
+          "[--checkpoint file]\n"
+          "       %s --merge result...\n"
+          "       %s --decode-trace file\n"
+          "       %s --generate count low high [--solutions min[-max]] "
+          "[--require ops]\n"
+          "           [--seed n] [--index file] [--format full|minimal|rpn] "
+          "[--cache-stats]\n"
+          "       %s --verify [file]\n"
+          "       %s --real [--target value] [--epsilon value]\n"
+          "       %s --page count [--cursor file]\n"
+          "       %s --countdown [-j threads] [--deadline ms]\n",
+          program, program, program, program, program, program, program,
+          program, program);
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  long nearMissCount = 0, threads = 0, shard = 0, shards = 1, pageSize = 0,
+       budget = 0, generateCount = 0;
+  bool batch = false, sweeping = false, sharded = false, cacheStats = false,
+       countdownMode = false, verifying = false, real = false,
+       realOptions = false, profiled = false, measuring = false;
+  struct DifficultyProfile profile = {
+      .minSolutions = 1, .maxSolutions = max_canonical_solutions,
+      .required = 0};
+  uint64_t seed = monotonicNanoseconds();
+  struct RealNumber realTarget = {{target_number, 1}, target_number};
+  double epsilon = 1e-6;
+  struct TreeConstraints treeConstraints = unconstrained;
+  const struct TreeConstraints *constraints = NULL;
+  enum OutputFormat format = format_full;
+  bool formatted = false;
+  const char *latencyFormat = NULL;
+  int low, high;
+  const char *path = NULL, *checkpoint = NULL, *cursor = NULL, *index = NULL,
+             *tracePath = NULL;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-b") == 0) {
+      batch = true;
+    } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+      if (parseCount(argv[++i], max_near_misses, &nearMissCount)) {
+        fprintf(stderr, "error: Near miss count must be between 1 and %d\n",
+                (int)max_near_misses);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      if (parseCount(argv[++i], 1024, &threads)) {
+        fputs("error: Thread count must be between 1 and 1024\n", stderr);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--sweep") == 0 && i + 2 < argc) {
+      if (parseSweepRange(argv[i + 1], argv[i + 2], &low, &high)) {
+        fprintf(stderr, "error: Invalid sweep range %s to %s\n", argv[i + 1],
+                argv[i + 2]);
+        return 1;
+      }
+      sweeping = true;
+      i += 2;
+    } else if (strcmp(argv[i], "--generate") == 0 && i + 3 < argc) {
+      if (parseCount(argv[i + 1], LONG_MAX, &generateCount)) {
+        fprintf(stderr, "error: Invalid puzzle count %s\n", argv[i + 1]);
+        return 1;
+      }
+      if (parseSweepRange(argv[i + 2], argv[i + 3], &low, &high)) {
+        fprintf(stderr, "error: Invalid range %s to %s\n", argv[i + 2],
+                argv[i + 3]);
+        return 1;
+      }
+      i += 3;
+    } else if (strcmp(argv[i], "--solutions") == 0 && i + 1 < argc) {
+      if (parseSolutionRange(argv[++i], &profile)) {
+        fprintf(stderr, "error: Solution counts must be between 0 and %d\n",
+                (int)max_canonical_solutions);
+        return 1;
+      }
+      profiled = true;
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      char *end;
+      ++i;
+      seed = strtoull(argv[i], &end, 10);
+      if (*argv[i] == '\0' || *end != '\0') {
+        fprintf(stderr, "error: Invalid seed %s\n", argv[i]);
+        return 1;
+      }
+      profiled = true;
+    } else if (strcmp(argv[i], "--index") == 0 && i + 1 < argc) {
+      index = argv[++i];
+      profiled = true;
+    } else if (strcmp(argv[i], "--shard") == 0 && i + 1 < argc) {
+      if (parseShard(argv[++i], &shard, &shards)) {
+        fprintf(stderr, "error: Invalid shard %s\n", argv[i]);
+        return 1;
+      }
+      sharded = true;
+    } else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+      latencyFormat = argv[++i];
+      if (strcmp(latencyFormat, "text") != 0 &&
+          strcmp(latencyFormat, "json") != 0) {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "--page") == 0 && i + 1 < argc) {
+      if (parseCount(argv[++i], max_canonical_solutions, &pageSize)) {
+        fprintf(stderr, "error: Page size must be between 1 and %d\n",
+                (int)max_canonical_solutions);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--deadline") == 0 && i + 1 < argc) {
+      if (parseCount(argv[++i], 3600000, &budget)) {
+        fputs("error: Deadline must be between 1 and 3600000 ms\n", stderr);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--cursor") == 0 && i + 1 < argc) {
+      cursor = argv[++i];
+    } else if ((strcmp(argv[i], "--operators") == 0 ||
+                strcmp(argv[i], "--require") == 0) &&
+               i + 1 < argc) {
+      unsigned char *mask = argv[i][2] == 'o' ? &treeConstraints.operators
+                                              : &treeConstraints.required;
+      if (parseOperators(argv[++i], mask)) {
+        fprintf(stderr, "error: Invalid operators %s\n", argv[i]);
+        return 1;
+      }
+      constraints = &treeConstraints;
+    } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+      ++i;
+      for (format = 0;
+           format < format_count && strcmp(argv[i], formatNames[format]) != 0;
+           ++format) {
+      }
+      if (format == format_count) {
+        usage(argv[0]);
+      }
+      formatted = true;
+    } else if (strcmp(argv[i], "--max-depth") == 0 && i + 1 < argc) {
+      long depth;
+      if (parseCount(argv[++i], ops_count, &depth)) {
+        fprintf(stderr, "error: Depth must be between 1 and %d\n",
+                (int)ops_count);
+        return 1;
+      }
+      treeConstraints.maxDepth = depth;
+      constraints = &treeConstraints;
+    } else if (strcmp(argv[i], "--left-deep") == 0) {
+      treeConstraints.leftDeep = true;
+      constraints = &treeConstraints;
+    } else if (strcmp(argv[i], "--features") == 0) {
+      measuring = true;
+    } else if (strcmp(argv[i], "--cache-stats") == 0) {
+      cacheStats = true;
+    } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+      checkpoint = argv[++i];
+    } else if (strcmp(argv[i], "--merge") == 0 && i + 1 < argc && i == 1) {
+      return mergeSweepResults(argv + 2, argc - 2);
+    } else if (strcmp(argv[i], "--decode-trace") == 0 && argc == 3 &&
+               i == 1) {
+      return decodeTraceFile(argv[2]);
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      tracePath = argv[++i];
+    } else if (strcmp(argv[i], "--real") == 0) {
+      real = true;
+    } else if (strcmp(argv[i], "--target") == 0 && i + 1 < argc) {
+      if (parseDecimal(argv[++i], &realTarget)) {
+        fprintf(stderr, "error: Invalid target %s\n", argv[i]);
+        return 1;
+      }
+      realOptions = true;
+    } else if (strcmp(argv[i], "--epsilon") == 0 && i + 1 < argc) {
+      char *end;
+      epsilon = strtod(argv[++i], &end);
+      if (*argv[i] == '\0' || *end != '\0' || !(epsilon > 0 && epsilon < 1)) {
+        fputs("error: Epsilon must be between 0 and 1\n", stderr);
+        return 1;
+      }
+      realOptions = true;
+    } else if (strcmp(argv[i], "--verify") == 0) {
+      verifying = true;
+    } else if (strcmp(argv[i], "--countdown") == 0) {
+      countdownMode = true;
+    } else if (argv[i][0] != '-' && !path) {
+      path = argv[i];
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (real) {
+    if (verifying || pageSize || cursor || constraints || formatted ||
+        countdownMode || batch || sweeping || sharded || checkpoint || path ||
+        latencyFormat || cacheStats || nearMissCount || threads || budget ||
+        tracePath || measuring) {
+      usage(argv[0]);
+    }
+    return solveReal(&realTarget, epsilon);
+  }
+  if (realOptions) {
+    usage(argv[0]);
+  }
+  if (generateCount) {
+    // --require names the operators every solution of the puzzle uses.
+    if (treeConstraints.operators != unconstrained.operators ||
+        treeConstraints.maxDepth != unconstrained.maxDepth ||
+        treeConstraints.leftDeep || verifying || pageSize || cursor ||
+        countdownMode || batch || sweeping || sharded || checkpoint || path ||
+        latencyFormat || nearMissCount || threads || budget || tracePath ||
+        measuring) {
+      usage(argv[0]);
+    }
+    profile.required = treeConstraints.required;
+    struct ReachableCache *reachable = createReachableCache();
+    const int ret = generatePuzzles(generateCount, low, high, &profile, seed,
+                                    index, format, reachable);
+    if (cacheStats) {
+      printReachableStats(stderr, reachable);
+    }
+    free(reachable);
+    return ret;
+  }
+  if (profiled) {
+    usage(argv[0]);
+  }
+  if (verifying) {
+    if (pageSize || cursor || constraints || formatted || countdownMode ||
+        batch || sweeping || sharded || checkpoint || latencyFormat ||
+        cacheStats || nearMissCount || threads || budget || tracePath ||
+        measuring) {
+      usage(argv[0]);
+    }
+    FILE *in = path ? fopen(path, "r") : stdin;
+    if (!in) {
+      fprintf(stderr, "error: Can't open %s\n", path);
+      return 1;
+    }
+    const int ret = verifyAnswers(in);
+    if (in != stdin) {
+      fclose(in);
+    }
+    return ret;
+  }
+  if (pageSize || cursor) {
+    if (!pageSize || constraints || formatted || countdownMode || batch ||
+        sweeping || sharded || checkpoint || path || latencyFormat ||
+        cacheStats || nearMissCount || threads || budget || tracePath ||
+        measuring) {
+      usage(argv[0]);
+    }
+    return printPage(pageSize, cursor);
+  }
+  if (countdownMode) {
+    if (constraints || formatted || batch || sweeping || sharded ||
+        checkpoint || path || latencyFormat || cacheStats || nearMissCount ||
+        tracePath || measuring) {
+      usage(argv[0]);
+    }
+    return countdown(threads ? threads : 1, budget);
+  }
+  if (budget) {
+    usage(argv[0]);
+  }
+  if ((threads || path || latencyFormat) && !batch) {
+    usage(argv[0]);
+  }
+  if (cacheStats && (!batch || nearMissCount)) {
+    usage(argv[0]);
+  }
+  if (sweeping || sharded || checkpoint) {
+    if (!sweeping || batch || nearMissCount || constraints || formatted ||
+        tracePath || measuring) {
+      usage(argv[0]);
+    }
+    return sweep(low, high, shard, shards, checkpoint);
+  }
+  // Puzzles with near misses to report have to visit every tree anyway.
+  struct ReachableCache *reachable =
+      batch && !nearMissCount ? createReachableCache() : NULL;
+  if (batch) {
+    FILE *in = path ? fopen(path, "r") : stdin;
+    if (!in) {
+      fprintf(stderr, "error: Can't open %s\n", path);
+      return 1;
+    }
+    int ret;
+#ifdef HAVE_ATOMICS
+    if (threads == 0) {
+      const long online = sysconf(_SC_NPROCESSORS_ONLN);
+      threads = online > 0 ? online : 1;
+    }
+#else
+    threads = 1;
+#endif
+    // Latencies are dumped at exit and whenever SIGUSR1 arrives.
+    struct LatencyReport latency = {.mode = threads > 1 ? "pipelined"
+                                                        : "serial",
+                                    .json = latencyFormat &&
+                                            strcmp(latencyFormat, "json") == 0,
+                                    .recorders = NULL,
+                                    .recorderCount = threads};
+    if (latencyFormat) {
+      latency.recorders =
+          xmalloc(sizeof(struct LatencyRecorder) * latency.recorderCount);
+      memset(latency.recorders, 0,
+             sizeof(struct LatencyRecorder) * latency.recorderCount);
+      struct sigaction action = {.sa_handler = requestLatencyDump};
+      sigemptyset(&action.sa_mask);
+      action.sa_flags = SA_RESTART;
+      sigaction(SIGUSR1, &action, NULL);
+    }
+    struct LatencyReport *report = latencyFormat ? &latency : NULL;
+    struct TraceWriter trace;
+    if (tracePath && openTraceWriter(&trace, tracePath, threads)) {
+      return 1;
+    }
+    struct TraceWriter *traceWriter = tracePath ? &trace : NULL;
+#ifdef HAVE_ATOMICS
+    ret = threads > 1
+              ? solveBatchPipelined(in, nearMissCount, constraints, format,
+                                    threads, report, reachable, traceWriter,
+                                    measuring)
+              : solveBatchSerial(in, nearMissCount, constraints, format,
+                                 report, reachable, traceWriter, measuring);
+#else
+    ret = solveBatchSerial(in, nearMissCount, constraints, format, report,
+                           reachable, traceWriter, measuring);
+#endif
+    if (in != stdin) {
+      fclose(in);
+    }
+    if (traceWriter) {
+      ret = closeTraceWriter(traceWriter) || ret;
+    }
+    if (report) {
+      dumpLatencies(report);
+      free(latency.recorders);
+    }
+    if (cacheStats) {
+      printReachableStats(stderr, reachable);
+    }
+    free(reachable);
+    return ret;
+  }
 
-int main() {
   int numbers[number_count];
   for (int i = 0; i < number_count; ++i) {
     const int code = scanf("%d", numbers + i);
@@ -509,15 +4967,21 @@ int main() {
       return 1;
     }
   }
-  sortInt(numbers, numbers + number_count);
-  struct SharedState state = (struct SharedState){
-      .seenTrees = xmalloc(sizeof(uint16_t) * initial_cache_size),
-      .size = 0,
-      .capacity = initial_cache_size};
-  iterateAllSyntaxTrees(numbers, checkAndPrintCallback, &state);
-  if (state.size == 0) {
-    puts("No solutions!");
+  static struct NearMissHeap nearMisses;
+  nearMisses.capacity = nearMissCount;
+  struct SharedState state;
+  initSharedState(&state, &nearMisses);
+  state.constraints = constraints;
+  state.templates.format = format;
+  struct DifficultyFeatures features;
+  state.features = measuring ? &features : NULL;
+  struct TraceWriter trace;
+  if (tracePath) {
+    if (openTraceWriter(&trace, tracePath, 1)) {
+      return 1;
+    }
+    state.trace = claimTraceRecorder(&trace);
   }
-  free(state.seenTrees);
-  return 0;
+  solvePuzzle(numbers, &state, stdout);
+  return tracePath && closeTraceWriter(&trace);
 }
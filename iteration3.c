@@ -135,16 +135,6 @@ static void printSyntaxTree(const SyntaxTree tree, const struct Node *curNode) {
   putchar('\n');
 }
 
-static void incrementOperators(enum OperatorKind ops[ops_count]) {
-  for (size_t i = 0; i < ops_count; ++i) {
-    ++ops[i];
-    if (ops[i] != op_div + 1) {
-      return;
-    }
-    ops[i] = op_add;
-  }
-}
-
 static void swap_impl(void *a, void *b, void *restrict c, size_t size) {
   memcpy(c, a, size);
   memmove(a, b, size);
@@ -156,63 +146,97 @@ static void swap_impl(void *a, void *b, void *restrict c, size_t size) {
       (char[sizeof(*(a)) == sizeof(*(b)) ? (ptrdiff_t)sizeof(*(a)) : -1]){0},  \
       sizeof(*(a)))
 
-static int compareOps(const enum OperatorKind lhs[ops_count],
-                      const enum OperatorKind rhs[ops_count]) {
-  for (int i = 0; i < ops_count; ++i) {
-    if (lhs[i] != rhs[i]) {
-      return 0;
+enum CallbackRet { Stop, Continue };
+
+// A tree is identified by its combination of operators and wiring, numbered
+// in the order the exhaustive nested loops used to visit them: operator
+// triples in the outer loop, then the operand choices of the first, second
+// and third operator. The last operator always takes the two remaining
+// operands. When the second operator combines two numbers, the third combines
+// both results, and only the order with the first result as its lhs is
+// numbered: the other one is the same tree with the first two operators
+// swapped. After each of the 12 choices of the first operator that leaves 4
+// choices of the second with 2 of the third and 2 with one, so every tree is
+// numbered exactly once.
+enum {
+  operator_combinations = 4 * 4 * 4,
+  wiring_count = 4 * 3 * (4 * 2 + 2 * 1),
+  tree_count = operator_combinations * wiring_count
+};
+
+// The order in which the search visits trees. It is learned by
+// `game24it3 --learn-order`, see learnSearchOrder().
+#include "iteration3-order.inc"
+
+// The first operator ends up at position first_rhs of the remaining
+// operands. Unless the second operator takes it as its lhs, it is then at the
+// returned position, since taking the lhs moves position 2 to second_lhs.
+static int firstResultPosition(int first_rhs, int second_lhs) {
+  return first_rhs == 2 ? second_lhs : first_rhs;
+}
+
+static bool combinesResults(int first_rhs, int second_lhs, int second_rhs) {
+  return second_lhs != first_rhs &&
+         second_rhs != firstResultPosition(first_rhs, second_lhs);
+}
+
+static void buildSyntaxTree(const int numbers[number_count],
+                            unsigned combination, SyntaxTree tree) {
+  const unsigned opBits = combination / wiring_count;
+  const unsigned wiring = combination % wiring_count;
+  const int first_lhs = wiring / 30, first_rhs = wiring / 10 % 3;
+  int choice = wiring % 10, second = 0;
+  for (;; ++second) {
+    const int thirds = combinesResults(first_rhs, second / 2, second % 2) ? 1 : 2;
+    if (choice < thirds) {
+      break;
     }
+    choice -= thirds;
   }
-  return 1;
-}
+  const int second_lhs = second / 2, second_rhs = second % 2, third_rhs = 0;
+  const int third_lhs = combinesResults(first_rhs, second_lhs, second_rhs)
+                            ? firstResultPosition(first_rhs, second_lhs)
+                            : choice;
 
-enum CallbackRet { Stop, Continue };
+  for (int i = 0; i < number_count; ++i) {
+    tree[i] = (struct Node){.kind = node_number, {.n = numbers[i]}};
+  }
+  for (int i = 0; i < ops_count; ++i) {
+    const enum OperatorKind kind = (opBits >> (2 * i)) & 3;
+    tree[i + 4] = (struct Node){.kind = node_operator, {.op = {kind, -1, -1}}};
+  }
+  char itab[all_count] = {0, 1, 2, 3, 4, 5, 6};
+  int arenaRight = number_count;
+  int curNode = number_count;
+  struct Node *curOperator = tree + number_count;
+  curOperator->v.op.lhs = itab[first_lhs];
+  swap(itab + first_lhs, itab + --arenaRight);
+  curOperator->v.op.rhs = itab[first_rhs];
+  swap(itab + first_rhs, itab + curNode++);
+  ++curOperator;
+  curOperator->v.op.lhs = itab[second_lhs];
+  swap(itab + second_lhs, itab + --arenaRight);
+  curOperator->v.op.rhs = itab[second_rhs];
+  swap(itab + second_rhs, itab + curNode++);
+  ++curOperator;
+  curOperator->v.op.lhs = itab[third_lhs];
+  swap(itab + third_lhs, itab + --arenaRight);
+  curOperator->v.op.rhs = itab[third_rhs];
+  swap(itab + third_rhs, itab + curNode++);
+}
 
+// Visits every tree, in the given order or in numbering order if order is
+// NULL.
 static enum CallbackRet iterateAllSyntaxTrees(
-    const int numbers[4],
+    const int numbers[4], const uint16_t order[tree_count],
     enum CallbackRet (*callback)(const SyntaxTree tree, const struct Node *root,
                                  void *data),
     void *data) {
   SyntaxTree tree;
-  static const enum OperatorKind finalOps[ops_count] = {op_div, op_div, op_div};
-  enum OperatorKind ops[ops_count] = {op_add, op_add, op_add};
-
-  for (; !compareOps(ops, finalOps); incrementOperators(ops)) {
-#define FOR_VAR(name, top) for (int name = 0; name < top; ++name)
-#define FOR_OPERAND(name, top)                                                 \
-  FOR_VAR(name##_lhs, top) FOR_VAR(name##_rhs, top - 1)
-    FOR_OPERAND(first, number_count)
-    FOR_OPERAND(second, number_count - 1) FOR_OPERAND(third, number_count - 2) {
-      // Setup the tree
-      for (int i = 0; i < number_count; ++i) {
-        tree[i] = (struct Node){.kind = node_number, {.n = numbers[i]}};
-      }
-      for (int i = 0; i < ops_count; ++i) {
-        tree[i + 4] =
-            (struct Node){.kind = node_operator, {.op = {ops[i], -1, -1}}};
-      }
-      char itab[all_count] = {0, 1, 2, 3, 4, 5, 6};
-      int arenaRight = number_count;
-      int curNode = number_count;
-      struct Node *curOperator = tree + number_count;
-      curOperator->v.op.lhs = itab[first_lhs];
-      swap(itab + first_lhs, itab + --arenaRight);
-      curOperator->v.op.rhs = itab[first_rhs];
-      swap(itab + first_rhs, itab + curNode++);
-      ++curOperator;
-      curOperator->v.op.lhs = itab[second_lhs];
-      swap(itab + second_lhs, itab + --arenaRight);
-      curOperator->v.op.rhs = itab[second_rhs];
-      swap(itab + second_rhs, itab + curNode++);
-      ++curOperator;
-      curOperator->v.op.lhs = itab[third_lhs];
-      swap(itab + third_lhs, itab + --arenaRight);
-      curOperator->v.op.rhs = itab[third_rhs];
-      swap(itab + third_rhs, itab + curNode++);
-      ++curOperator;
-      if (callback(tree, tree + all_count - 1, data) != Continue) {
-        return Stop;
-      }
+  for (unsigned i = 0; i < tree_count; ++i) {
+    buildSyntaxTree(numbers, order ? order[i] : i, tree);
+    if (callback(tree, tree + all_count - 1, data) != Continue) {
+      return Stop;
     }
   }
   return Continue;
@@ -229,7 +253,236 @@ static enum CallbackRet checkAndPrintCallback(const SyntaxTree tree,
   return Stop;
 }
 
-int main() {
+static bool isSolution(const SyntaxTree tree, const struct Node *root) {
+  const EvalResult res = evalSyntaxTree(tree, root);
+  return res.valid && res.num == 24;
+}
+
+static void sortNumbers(int numbers[number_count]) {
+  for (int i = 1; i < number_count; ++i) {
+    for (int j = i; j > 0 && numbers[j - 1] > numbers[j]; --j) {
+      swap(numbers + j - 1, numbers + j);
+    }
+  }
+}
+
+// Calls callback for every sorted quadruple with numbers in [low, high].
+static void iterateQuadruples(int low, int high,
+                              void (*callback)(const int numbers[number_count],
+                                               void *data),
+                              void *data) {
+  for (int a = low; a <= high; ++a) {
+    for (int b = a; b <= high; ++b) {
+      for (int c = b; c <= high; ++c) {
+        for (int d = c; d <= high; ++d) {
+          const int numbers[number_count] = {a, b, c, d};
+          callback(numbers, data);
+        }
+      }
+    }
+  }
+}
+
+// The hits of every tree over a set of puzzles, as one bit set per tree.
+struct HitMatrix {
+  uint64_t *hits;
+  size_t words, puzzles;
+};
+
+static void recordHits(const int numbers[number_count], void *data) {
+  struct HitMatrix *matrix = data;
+  SyntaxTree tree;
+  for (unsigned i = 0; i < tree_count; ++i) {
+    buildSyntaxTree(numbers, i, tree);
+    if (isSolution(tree, tree + all_count - 1)) {
+      matrix->hits[i * matrix->words + matrix->puzzles / 64] |=
+          (uint64_t)1 << (matrix->puzzles % 64);
+    }
+  }
+  ++matrix->puzzles;
+}
+
+static void countPuzzles(const int numbers[number_count], void *data) {
+  (void)numbers;
+  ++*(size_t *)data;
+}
+
+static size_t countCommonHits(const uint64_t *hits, const uint64_t *unsolved,
+                              size_t words) {
+  size_t count = 0;
+  for (size_t i = 0; i < words; ++i) {
+    for (uint64_t word = hits[i] & unsolved[i]; word; word &= word - 1) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+// Learns the search order from every puzzle with numbers in [low, high] and
+// prints it as the contents of iteration3-order.inc. Greedily, the next tree
+// is the one that solves the most puzzles no earlier tree solves. Once every
+// solvable puzzle is covered, the remaining trees follow by their total
+// number of hits. Ties keep the numbering order, so the output is
+// deterministic.
+static int learnSearchOrder(int low, int high) {
+  struct HitMatrix matrix = {.puzzles = 0};
+  size_t puzzles = 0;
+  iterateQuadruples(low, high, countPuzzles, &puzzles);
+  matrix.words = (puzzles + 63) / 64;
+  matrix.hits = xmalloc(sizeof(uint64_t) * matrix.words * tree_count);
+  memset(matrix.hits, 0, sizeof(uint64_t) * matrix.words * tree_count);
+  iterateQuadruples(low, high, recordHits, &matrix);
+
+  uint64_t *unsolved = xmalloc(sizeof(uint64_t) * matrix.words);
+  memset(unsolved, 0xff, sizeof(uint64_t) * matrix.words);
+  size_t *totals = xmalloc(sizeof(size_t) * tree_count);
+  bool *taken = xmalloc(sizeof(bool) * tree_count);
+  for (unsigned i = 0; i < tree_count; ++i) {
+    totals[i] =
+        countCommonHits(matrix.hits + i * matrix.words, unsolved, matrix.words);
+    taken[i] = false;
+  }
+  uint16_t order[tree_count];
+  for (unsigned placed = 0; placed < tree_count; ++placed) {
+    unsigned best = tree_count;
+    size_t bestHits = 0, bestTotal = 0;
+    for (unsigned i = 0; i < tree_count; ++i) {
+      if (taken[i]) {
+        continue;
+      }
+      const size_t hits = countCommonHits(matrix.hits + i * matrix.words,
+                                          unsolved, matrix.words);
+      if (best == tree_count || hits > bestHits ||
+          (hits == bestHits && totals[i] > bestTotal)) {
+        best = i;
+        bestHits = hits;
+        bestTotal = totals[i];
+      }
+    }
+    order[placed] = best;
+    taken[best] = true;
+    for (size_t i = 0; i < matrix.words; ++i) {
+      unsolved[i] &= ~matrix.hits[best * matrix.words + i];
+    }
+  }
+
+  printf("/* Generated by `game24it3 --learn-order %d %d`. */\n"
+         "static const uint16_t searchOrder[tree_count] = {",
+         low, high);
+  for (unsigned i = 0; i < tree_count; ++i) {
+    printf(i % 10 ? " %u," : "\n    %u,", (unsigned)order[i]);
+  }
+  puts("\n};");
+  free(taken);
+  free(totals);
+  free(unsolved);
+  free(matrix.hits);
+  return 0;
+}
+
+static enum CallbackRet countUntilHitCallback(const SyntaxTree tree,
+                                              const struct Node *root,
+                                              void *data) {
+  ++*(size_t *)data;
+  return isSolution(tree, root) ? Stop : Continue;
+}
+
+// Trees evaluated before the first hit, for every solvable puzzle.
+struct OrderStatistics {
+  const uint16_t *order;
+  size_t *evaluated;
+  size_t solvable, puzzles;
+};
+
+static void measureOrder(const int numbers[number_count], void *data) {
+  struct OrderStatistics *stats = data;
+  size_t evaluated = 0;
+  if (iterateAllSyntaxTrees(numbers, stats->order, countUntilHitCallback,
+                            &evaluated) == Stop) {
+    stats->evaluated[stats->solvable++] = evaluated;
+  }
+  ++stats->puzzles;
+}
+
+static int compareSizes(const void *lhs, const void *rhs) {
+  const size_t a = *(const size_t *)lhs, b = *(const size_t *)rhs;
+  return a < b ? -1 : a > b;
+}
+
+static void printOrderStatistics(const char *name,
+                                 struct OrderStatistics *stats) {
+  qsort(stats->evaluated, stats->solvable, sizeof(size_t), compareSizes);
+  double sum = 0;
+  for (size_t i = 0; i < stats->solvable; ++i) {
+    sum += stats->evaluated[i];
+  }
+#define PERCENTILE(p) stats->evaluated[(stats->solvable - 1) * (p) / 100]
+  printf("%-8s %9.1f %6zu %6zu %6zu %6zu\n", name, sum / stats->solvable,
+         PERCENTILE(50), PERCENTILE(90), PERCENTILE(99), PERCENTILE(100));
+#undef PERCENTILE
+}
+
+// Compares how many trees the numbering order and the learned order evaluate
+// before the first hit on every solvable puzzle with numbers in [low, high].
+static int compareSearchOrders(int low, int high) {
+  size_t puzzles = 0;
+  iterateQuadruples(low, high, countPuzzles, &puzzles);
+  struct OrderStatistics fixed = {.order = NULL,
+                                  .evaluated = xmalloc(sizeof(size_t) * puzzles),
+                                  .solvable = 0,
+                                  .puzzles = 0},
+                         learned = {.order = searchOrder,
+                                    .evaluated =
+                                        xmalloc(sizeof(size_t) * puzzles),
+                                    .solvable = 0,
+                                    .puzzles = 0};
+  iterateQuadruples(low, high, measureOrder, &fixed);
+  iterateQuadruples(low, high, measureOrder, &learned);
+  printf("%zu of %zu puzzles are solvable\n", fixed.solvable, fixed.puzzles);
+  if (fixed.solvable > 0) {
+    printf("order         mean    p50    p90    p99    max\n");
+    printOrderStatistics("fixed", &fixed);
+    printOrderStatistics("learned", &learned);
+  }
+  free(fixed.evaluated);
+  free(learned.evaluated);
+  return 0;
+}
+
+static int parseRange(const char *lowArg, const char *highArg, int *low,
+                      int *high) {
+  char *lowEnd, *highEnd;
+  const long lowValue = strtol(lowArg, &lowEnd, 10),
+             highValue = strtol(highArg, &highEnd, 10);
+  if (lowEnd == lowArg || *lowEnd != '\0' || highEnd == highArg ||
+      *highEnd != '\0' || lowValue > highValue || lowValue < -1000 ||
+      highValue > 1000 || highValue - lowValue > 100) {
+    return 1;
+  }
+  *low = lowValue;
+  *high = highValue;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc == 4 && (strcmp(argv[1], "--learn-order") == 0 ||
+                    strcmp(argv[1], "--order-stats") == 0)) {
+    int low, high;
+    if (parseRange(argv[2], argv[3], &low, &high)) {
+      fprintf(stderr, "error: Invalid range %s to %s\n", argv[2], argv[3]);
+      return 1;
+    }
+    return strcmp(argv[1], "--learn-order") == 0
+               ? learnSearchOrder(low, high)
+               : compareSearchOrders(low, high);
+  } else if (argc != 1) {
+    fprintf(stderr,
+            "usage: %s\n"
+            "       %s --learn-order low high\n"
+            "       %s --order-stats low high\n",
+            argv[0], argv[0], argv[0]);
+    return 1;
+  }
   int numbers[number_count];
   for (int i = 0; i < number_count; ++i) {
     const int code = scanf("%d", numbers + i);
@@ -238,7 +491,10 @@ int main() {
       return 1;
     }
   }
-  if (iterateAllSyntaxTrees(numbers, checkAndPrintCallback, NULL) == Continue) {
+  // The search order is learned on sorted puzzles.
+  sortNumbers(numbers);
+  if (iterateAllSyntaxTrees(numbers, searchOrder, checkAndPrintCallback,
+                            NULL) == Continue) {
     puts("No solutions!");
   }
   return 0;
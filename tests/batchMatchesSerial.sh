@@ -0,0 +1,80 @@
+#!/bin/sh
+
+# Compares the batch modes against solving every puzzle on its own.
+
+PROG="$1"
+TMP="$(mktemp -d)" || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+N1=1
+while [ "$N1" -le 7 ]
+do
+    N2=1
+    while [ "$N2" -le 7 ]
+    do
+	printf '%d %d %d %d\n' "$N1" "$N2" "$((N1 + N2))" "$((N1 * N2))"
+	N2=$((N2 + 1))
+    done
+    N1=$((N1 + 1))
+done >"$TMP/puzzles.in"
+
+while read N1 N2 N3 N4
+do
+    printf '%d %d %d %d:\n' "$N1" "$N2" "$N3" "$N4"
+    echo "$N1 $N2 $N3 $N4" | "$PROG" -k 2
+done <"$TMP/puzzles.in" >"$TMP/expected.out"
+
+RET=0
+for THREADS in 1 2 5
+do
+    # Regular files are memory mapped, pipes are read line by line.
+    "$PROG" -b -k 2 -j "$THREADS" <"$TMP/puzzles.in" >"$TMP/mapped.out"
+    MAPPED=$?
+    cat "$TMP/puzzles.in" | "$PROG" -b -k 2 -j "$THREADS" >"$TMP/piped.out"
+    PIPED=$?
+    for MODE in mapped piped
+    do
+	if ! cmp "$TMP/expected.out" "$TMP/$MODE.out"
+	then
+	    echo "Batch output ($MODE) with $THREADS threads differs from single runs"
+	    RET=1
+	fi
+    done
+    if [ "$MAPPED" != 0 ] || [ "$PIPED" != 0 ]
+    then
+	echo "Batch mode failed with $THREADS threads"
+	RET=1
+    fi
+
+    # Recording latencies must not change the output.
+    "$PROG" -b -k 2 -j "$THREADS" --latency json "$TMP/puzzles.in" \
+	    >"$TMP/latency.out" 2>"$TMP/latency.err"
+    if ! cmp -s "$TMP/expected.out" "$TMP/latency.out"
+    then
+	echo "Recording latencies with $THREADS threads changes the output"
+	RET=1
+    fi
+    TOTAL="$(grep -o '"count": [0-9]*' "$TMP/latency.err" |
+		  awk '{ total += $2 } END { print total }')"
+    if [ "$TOTAL" != 49 ]
+    then
+	echo "Latencies of $TOTAL instead of 49 puzzles were recorded with $THREADS threads"
+	RET=1
+    fi
+
+    printf '1 2 3 4\n\n 5 5 5 5 \n1 2 x 4\n3 3 8 8\n' >"$TMP/malformed.in"
+    if "$PROG" -b -j "$THREADS" "$TMP/malformed.in" >"$TMP/malformed.out" \
+	       2>"$TMP/malformed.err"
+    then
+	echo "Malformed input was accepted with $THREADS threads"
+	RET=1
+    fi
+    if ! grep -q 'line 4$' "$TMP/malformed.err" ||
+	    [ "$(grep -c ':$' "$TMP/malformed.out")" != 2 ]
+    then
+	echo "Malformed input is reported wrongly with $THREADS threads"
+	RET=1
+    fi
+done
+
+exit "$RET"
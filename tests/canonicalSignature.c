@@ -0,0 +1,164 @@
+#define main xmain
+#include "../iteration2.c"
+
+#undef main
+
+int result = 0;
+
+// Every signature seen under any pattern, to bound the canonical solutions.
+static bool seenSignatures[UINT16_MAX + 1];
+
+// Trees are fingerprinted by evaluating them modulo a prime with random
+// values for the numbers. Trees that only differ by the rules the
+// canonicalizer applies have equal fingerprints, so two trees with the same
+// signature but different fingerprints aren't equivalent.
+enum { fingerprint_prime = 2147483647 };
+
+static uint64_t powMod(uint64_t base, uint64_t exponent) {
+  uint64_t power = 1;
+  for (; exponent; exponent >>= 1, base = base * base % fingerprint_prime) {
+    if (exponent & 1) {
+      power = power * base % fingerprint_prime;
+    }
+  }
+  return power;
+}
+
+// Returns false for a division by zero.
+static bool fingerprintTree(PackedTree tree, const uint64_t values[],
+                            unsigned idx, uint64_t *fingerprint) {
+  const unsigned slot = packedSlot(tree, idx);
+  if (slotKind(slot) == node_number) {
+    *fingerprint = values[slotNumber(slot)];
+    return true;
+  }
+  uint64_t lhs, rhs;
+  if (!fingerprintTree(tree, values, slotLhs(slot), &lhs) ||
+      !fingerprintTree(tree, values, slotRhs(slot), &rhs)) {
+    return false;
+  }
+  switch (slotOperator(slot)) {
+  case op_add:
+    *fingerprint = (lhs + rhs) % fingerprint_prime;
+    break;
+  case op_sub:
+    *fingerprint = (lhs + fingerprint_prime - rhs) % fingerprint_prime;
+    break;
+  case op_mul:
+    *fingerprint = lhs * rhs % fingerprint_prime;
+    break;
+  case op_div:
+    if (rhs == 0) {
+      return false;
+    }
+    *fingerprint = lhs * powMod(rhs, fingerprint_prime - 2) % fingerprint_prime;
+  }
+  return true;
+}
+
+struct SignatureCheck {
+  const char *pattern;
+  size_t trees;
+  unsigned char classes[number_count];
+  uint64_t values[number_count];
+  bool seen[UINT16_MAX + 1];
+  uint64_t fingerprints[UINT16_MAX + 1];
+};
+
+static void checkSignature(PackedTree tree, const int numbers[], void *data) {
+  struct SignatureCheck *check = data;
+  ++check->trees;
+  PackedTree canonical = tree;
+  canonicalizePackedTree(&canonical, check->classes);
+  const uint16_t found = canonicalSignature(tree, check->classes);
+  seenSignatures[found] = true;
+  if (canonicalSignature(canonical, check->classes) != found ||
+      rankCanonicalTree(canonical, check->classes) != found) {
+    SyntaxTree unpacked;
+    unpackTree(tree, numbers, unpacked);
+    printf("%s: %d: Canonicalizing changes the signature for pattern %s: ",
+           __FILE__, __LINE__, check->pattern);
+    debugPrintTree(unpacked);
+    result = 1;
+  }
+  uint64_t fingerprint;
+  if (!fingerprintTree(tree, check->values, all_count - 1, &fingerprint)) {
+    return;
+  }
+  if (!check->seen[found]) {
+    check->seen[found] = true;
+    check->fingerprints[found] = fingerprint;
+  } else if (check->fingerprints[found] != fingerprint) {
+    SyntaxTree unpacked;
+    unpackTree(tree, numbers, unpacked);
+    printf("%s: %d: Signature %d is shared by a tree that isn't equivalent "
+           "for pattern %s: ",
+           __FILE__, __LINE__, (int)found, check->pattern);
+    debugPrintTree(unpacked);
+    result = 1;
+  }
+}
+
+int main() {
+  // Every multiplicity pattern of a sorted quadruple.
+  static const struct {
+    const char *name;
+    int numbers[number_count];
+  } patterns[] = {{"aaaa", {1, 1, 1, 1}}, {"aaab", {1, 1, 1, 2}},
+                  {"aabb", {1, 1, 2, 2}}, {"abbb", {1, 2, 2, 2}},
+                  {"aabc", {1, 1, 2, 3}}, {"abbc", {1, 2, 2, 3}},
+                  {"abcc", {1, 2, 3, 3}}, {"abcd", {1, 2, 3, 4}}};
+  static struct SignatureCheck check;
+  uint64_t seed = 24;
+  size_t expectedTrees = 0;
+  for (size_t i = 0; i < sizeof(patterns) / sizeof(*patterns); ++i) {
+    memset(&check, 0, sizeof(check));
+    check.pattern = patterns[i].name;
+    numberClasses(patterns[i].numbers, check.classes);
+    for (unsigned j = 0; j < number_count; ++j) {
+      check.values[j] = check.classes[j] == j
+                            ? nextRandom(&seed) % fingerprint_prime
+                            : check.values[check.classes[j]];
+    }
+    iteratePackedTrees(patterns[i].numbers, checkSignature, &check);
+    if (i == 0) {
+      expectedTrees = check.trees;
+    } else if (check.trees != expectedTrees) {
+      printf("%s: %d: Pattern %s visited %d trees instead of %d\n", __FILE__,
+             __LINE__, check.pattern, (int)check.trees, (int)expectedTrees);
+      result = 1;
+    }
+  }
+
+  // 8 + (2 + 2) * 4 and 8 + 2 * 2 * 4 only differ by their operators.
+  const int numbers[number_count] = {2, 2, 4, 8};
+  unsigned char classes[number_count];
+  numberClasses(numbers, classes);
+  PackedTree sum = 0, product = 0;
+  for (unsigned i = 0; i < number_count; ++i) {
+    setPackedSlot(&sum, i, makePackedNumber(i));
+  }
+  setPackedSlot(&sum, 4, makePackedOperator(op_add, 0, 1));
+  setPackedSlot(&sum, 5, makePackedOperator(op_mul, 4, 2));
+  setPackedSlot(&sum, 6, makePackedOperator(op_add, 3, 5));
+  product = sum;
+  setPackedSlot(&product, 4, makePackedOperator(op_mul, 0, 1));
+  if (canonicalSignature(sum, classes) == canonicalSignature(product, classes)) {
+    printf("%s: %d: 8 + (2 + 2) * 4 and 8 + 2 * 2 * 4 have the same "
+           "signature\n",
+           __FILE__, __LINE__);
+    result = 1;
+  }
+
+  size_t signatures = 0;
+  for (size_t i = 0; i <= UINT16_MAX; ++i) {
+    signatures += seenSignatures[i];
+  }
+  if (signatures > max_canonical_solutions) {
+    printf("%s: %d: Found %d canonical signatures, but the solver only has "
+           "room for %d\n",
+           __FILE__, __LINE__, (int)signatures, (int)max_canonical_solutions);
+    result = 1;
+  }
+  return result;
+}
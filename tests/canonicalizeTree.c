@@ -34,6 +34,22 @@ static void checkTreeCannonIsEqual(SyntaxTree lhs, SyntaxTree rhs) {
   }
 }
 
+static void checkTreeCannonDiffers(SyntaxTree lhs, SyntaxTree rhs) {
+  SyntaxTree lhsCopy, rhsCopy;
+  memcpy(lhsCopy, lhs, sizeof(SyntaxTree));
+  memcpy(rhsCopy, rhs, sizeof(SyntaxTree));
+  canonicalizeTree(lhsCopy, lhsCopy + all_count - 1);
+  canonicalizeTree(rhsCopy, rhsCopy + all_count - 1);
+  if (equalSyntaxTree(lhsCopy, rhsCopy)) {
+    printf("%s: %d: Expected ", __FILE__, __LINE__);
+    printFullTree(lhs);
+    printf(" and ");
+    printFullTree(rhs);
+    printf(" to differ in their canonicalized form\n");
+    result = 1;
+  }
+}
+
 static void checkTreeStaysUnchanged(SyntaxTree tree) {
   SyntaxTree copy;
   memcpy(copy, tree, sizeof(SyntaxTree));
@@ -105,6 +121,34 @@ int main() {
                    makeOp(op_mul, 5, 4)},
       (SyntaxTree){THE_NUMS, makeOp(op_mul, 0, 2), makeOp(op_div, 3, 1),
                    makeOp(op_mul, 4, 5)});
+  // ((1 - 2) + 3) * 4
+  // ((1 + 3) - 2) * 4
+  checkTreeCannonIsEqual(
+      (SyntaxTree){THE_NUMS, makeOp(op_sub, 0, 1), makeOp(op_add, 4, 2),
+                   makeOp(op_mul, 5, 3)},
+      (SyntaxTree){THE_NUMS, makeOp(op_add, 0, 2), makeOp(op_sub, 4, 1),
+                   makeOp(op_mul, 5, 3)});
+  // (1 - (2 - 3)) - 4
+  // (1 + 3) - (2 + 4)
+  checkTreeCannonIsEqual(
+      (SyntaxTree){THE_NUMS, makeOp(op_sub, 1, 2), makeOp(op_sub, 0, 4),
+                   makeOp(op_sub, 5, 3)},
+      (SyntaxTree){THE_NUMS, makeOp(op_add, 0, 2), makeOp(op_add, 1, 3),
+                   makeOp(op_sub, 4, 5)});
+  // (1 / (2 / 3)) + 4
+  // 4 + ((1 * 3) / 2)
+  checkTreeCannonIsEqual(
+      (SyntaxTree){THE_NUMS, makeOp(op_div, 1, 2), makeOp(op_div, 0, 4),
+                   makeOp(op_add, 5, 3)},
+      (SyntaxTree){THE_NUMS, makeOp(op_mul, 0, 2), makeOp(op_div, 4, 1),
+                   makeOp(op_add, 3, 5)});
+  // ((1 - 2) + 3) * 4
+  // (1 - (2 + 3)) * 4
+  checkTreeCannonDiffers(
+      (SyntaxTree){THE_NUMS, makeOp(op_sub, 0, 1), makeOp(op_add, 4, 2),
+                   makeOp(op_mul, 5, 3)},
+      (SyntaxTree){THE_NUMS, makeOp(op_add, 1, 2), makeOp(op_sub, 0, 4),
+                   makeOp(op_mul, 5, 3)});
   checkTreeStaysFullyAccessable((SyntaxTree){THE_NUMS, makeOp(op_mul, 0, 2),
                                              makeOp(op_mul, 4, 3),
                                              makeOp(op_sub, 5, 1)});
@@ -0,0 +1,231 @@
+#define main xmain
+#include "../iteration2.c"
+
+#undef main
+
+int result = 0;
+
+// Tries every pair and every operator without any pruning.
+static void naiveClosest(const int64_t values[], size_t count, int64_t target,
+                         uint64_t *best) {
+  for (size_t i = 0; i < count; ++i) {
+    if (absDifference(values[i], target) < *best) {
+      *best = absDifference(values[i], target);
+    }
+  }
+  int64_t next[countdown_number_count];
+  for (size_t i = 0; i < count; ++i) {
+    for (size_t j = 0; j < count; ++j) {
+      if (i == j) {
+        continue;
+      }
+      const int64_t a = values[i], b = values[j];
+      const int64_t results[4] = {a + b, a - b, a * b, b && a % b == 0 ? a / b : 0};
+      size_t nextCount = 0;
+      for (size_t k = 0; k < count; ++k) {
+        if (k != i && k != j) {
+          next[nextCount++] = values[k];
+        }
+      }
+      for (int op = 0; op < 4; ++op) {
+        if (results[op] <= 0) {
+          continue;
+        }
+        next[nextCount] = results[op];
+        naiveClosest(next, nextCount + 1, target, best);
+      }
+    }
+  }
+}
+
+static int64_t evalCountdownNode(const struct Node nodes[], unsigned char idx) {
+  const struct Node *node = nodes + idx;
+  if (node->kind == node_number) {
+    return node->v.n;
+  }
+  const int64_t lhs = evalCountdownNode(nodes, node->v.op.lhs),
+                rhs = evalCountdownNode(nodes, node->v.op.rhs);
+  if (lhs <= 0 || rhs <= 0) {
+    return -1;
+  }
+  switch (node->v.op.kind) {
+  case op_add:
+    return lhs + rhs;
+  case op_sub:
+    return lhs - rhs;
+  case op_mul:
+    return lhs * rhs;
+  case op_div:
+    return lhs % rhs == 0 ? lhs / rhs : -1;
+  }
+  CANT_REACH
+}
+
+// Returns whether every number is used at most once.
+static bool usesNumbersOnce(const struct Node nodes[], unsigned char idx,
+                            unsigned *used) {
+  const struct Node *node = nodes + idx;
+  if (node->kind == node_number) {
+    const bool fresh = !(*used >> idx & 1);
+    *used |= 1u << idx;
+    return fresh;
+  }
+  return usesNumbersOnce(nodes, node->v.op.lhs, used) &&
+         usesNumbersOnce(nodes, node->v.op.rhs, used);
+}
+
+static void printBest(const struct CountdownSearch *search, char *buffer,
+                      size_t size) {
+  FILE *out = fmemopen(buffer, size, "w");
+  printCountdownNode(out, search->bestNodes, search->bestRoot);
+  fclose(out);
+}
+
+// The parallel search has to find exactly the expression the serial one does.
+static void checkParallel(struct CountdownSearch *search,
+                          struct CountdownSearch *parallel, bool solved,
+                          const int numbers[], unsigned char count, int target,
+                          int line) {
+  const bool parallelSolved =
+      solveCountdownParallel(parallel, numbers, count, target, 4);
+  char expected[256], found[256];
+  printBest(search, expected, sizeof(expected));
+  printBest(parallel, found, sizeof(found));
+  if (parallelSolved != solved || strcmp(expected, found) != 0) {
+    printf("%s: %d: Parallel search found %s instead of %s\n", __FILE__, line,
+           found, expected);
+    result = 1;
+  }
+}
+
+static void checkInstance(struct CountdownSearch *search,
+                          struct CountdownSearch *parallel, const int numbers[],
+                          unsigned char count, int target, int line) {
+  const bool solved = solveCountdown(search, numbers, count, target);
+  checkParallel(search, parallel, solved, numbers, count, target, line);
+  const int64_t value = evalCountdownNode(search->bestNodes, search->bestRoot);
+  unsigned used = 0;
+  if (value != search->bestValue ||
+      !usesNumbersOnce(search->bestNodes, search->bestRoot, &used)) {
+    printf("%s: %d: Best expression doesn't evaluate to %" PRId64 "\n",
+           __FILE__, line, search->bestValue);
+    result = 1;
+  }
+  if (solved != (value == target)) {
+    printf("%s: %d: Solved is %d for value %" PRId64 "\n", __FILE__, line,
+           solved, value);
+    result = 1;
+  }
+  int64_t values[countdown_number_count];
+  for (unsigned char i = 0; i < count; ++i) {
+    values[i] = numbers[i];
+  }
+  uint64_t best = UINT64_MAX;
+  naiveClosest(values, count, target, &best);
+  if (absDifference(value, target) != best) {
+    printf("%s: %d: Expected distance %" PRIu64 " but found %" PRIu64 "\n",
+           __FILE__, line, best, absDifference(value, target));
+    result = 1;
+  }
+}
+
+// A search that is out of time at once still leaves a valid expression, and
+// one with plenty of time finds what an unbounded search does.
+static void checkDeadline(struct CountdownSearch *search, const int numbers[],
+                          unsigned char count, int target, bool parallel) {
+  char expected[256], found[256];
+  solveCountdown(search, numbers, count, target);
+  printBest(search, expected, sizeof(expected));
+  search->deadline = 1;
+  const bool solved =
+      parallel ? solveCountdownParallel(search, numbers, count, target, 4)
+               : solveCountdown(search, numbers, count, target);
+  const int64_t value = evalCountdownNode(search->bestNodes, search->bestRoot);
+  if (solved || !search->timedOut || search->progress < 0 ||
+      search->progress >= 1 || value != search->bestValue) {
+    printf("%s: %d: Expired search returned %d, timed out %d, progress %g\n",
+           __FILE__, __LINE__, solved, search->timedOut, search->progress);
+    result = 1;
+  }
+  search->deadline = monotonicNanoseconds() + UINT64_C(3600000000000);
+  if (parallel) {
+    solveCountdownParallel(search, numbers, count, target, 4);
+  } else {
+    solveCountdown(search, numbers, count, target);
+  }
+  printBest(search, found, sizeof(found));
+  if (search->timedOut || search->progress != 1 ||
+      strcmp(expected, found) != 0) {
+    printf("%s: %d: Search with a deadline found %s instead of %s\n",
+           __FILE__, __LINE__, found, expected);
+    result = 1;
+  }
+  search->deadline = 0;
+}
+
+int main() {
+  struct CountdownSearch *search = xmalloc(sizeof(struct CountdownSearch)),
+                         *parallel = xmalloc(sizeof(struct CountdownSearch));
+  initCountdownSearch(search);
+  initCountdownSearch(parallel);
+  checkInstance(search, parallel, (const int[]){75, 50, 2, 3, 8, 7}, 6, 812,
+                __LINE__);
+  checkInstance(search, parallel, (const int[]){100, 75, 50, 25, 6, 3}, 6, 952,
+                __LINE__);
+  checkInstance(search, parallel, (const int[]){1, 1, 1, 1, 1, 1}, 6, 999,
+                __LINE__);
+  checkInstance(search, parallel, (const int[]){7}, 1, 7, __LINE__);
+  checkInstance(search, parallel, (const int[]){8, 3}, 2, 24, __LINE__);
+
+  // Too large for the naive search, so only serial and parallel are compared.
+  static const int large[][countdown_number_count + 1] = {
+      {3, 25, 10, 100, 4, 75, 9, 733},
+      {1, 2, 3, 4, 5, 6, 7, 8, 98765},
+      {2, 3, 5, 7, 11, 13, 17, 19, 999999},
+      {8, 7, 4, 2, 3, 6, 946},
+      {50, 9, 10, 4, 2, 100, 753}};
+  static const unsigned char largeCounts[] = {7, 8, 8, 6, 6};
+  for (size_t i = 0; i < sizeof(largeCounts); ++i) {
+    const bool solved = solveCountdown(search, large[i], largeCounts[i],
+                                       large[i][largeCounts[i]]);
+    checkParallel(search, parallel, solved, large[i], largeCounts[i],
+                  large[i][largeCounts[i]], __LINE__);
+  }
+  checkDeadline(search, large[0], largeCounts[0], large[0][largeCounts[0]],
+                false);
+  checkDeadline(search, large[0], largeCounts[0], large[0][largeCounts[0]],
+                true);
+
+  static const int pool[] = {1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7,
+                             8, 8, 9, 9, 10, 10, 25, 50, 75, 100};
+  const size_t poolSize = sizeof(pool) / sizeof(*pool);
+  uint32_t seed = 24;
+  // Five numbers are checked against the naive search, six only against the
+  // serial search.
+  for (int instance = 0; instance < 80; ++instance) {
+    const unsigned char count = instance < 40 ? 5 : 6;
+    int numbers[countdown_number_count];
+    unsigned taken = 0;
+    for (int i = 0; i < count; ++i) {
+      size_t idx;
+      do {
+        seed = seed * 1103515245 + 12345;
+        idx = (seed >> 8) % poolSize;
+      } while (taken >> idx & 1);
+      taken |= 1u << idx;
+      numbers[i] = pool[idx];
+    }
+    seed = seed * 1103515245 + 12345;
+    const int target = 100 + (seed >> 8) % 900;
+    if (count == 5) {
+      checkInstance(search, parallel, numbers, count, target, __LINE__);
+    } else {
+      const bool solved = solveCountdown(search, numbers, count, target);
+      checkParallel(search, parallel, solved, numbers, count, target,
+                    __LINE__);
+    }
+  }
+  free(search);
+  free(parallel);
+  return result;
+}
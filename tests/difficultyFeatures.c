@@ -0,0 +1,109 @@
+#define main xmain
+#include "../iteration2.c"
+
+#undef main
+
+int result = 0;
+
+static void solveWithFeatures(const int numbers[number_count],
+                              struct SharedState *state,
+                              struct DifficultyFeatures *features) {
+  static struct NearMissHeap nearMisses;
+  initSharedState(state, &nearMisses);
+  state->out = NULL;
+  state->features = features;
+  int sorted[number_count];
+  memcpy(sorted, numbers, sizeof(sorted));
+  countSolutions(sorted, state);
+}
+
+static void checkFeatures(const int numbers[number_count]) {
+  struct SharedState state;
+  struct DifficultyFeatures features;
+  solveWithFeatures(numbers, &state, &features);
+
+  int sorted[number_count];
+  memcpy(sorted, numbers, sizeof(sorted));
+  sortInt(sorted, sorted + number_count);
+  unsigned hits[operator_triples] = {0};
+  unsigned minDepth = ops_count;
+  for (unsigned i = 0; i < tree_count; ++i) {
+    const PackedTree tree = packedTreeAt(i);
+    const EvalResult res = evalPackedTree(tree, sorted, all_count - 1);
+    if (!res.valid || res.num != target_number) {
+      continue;
+    }
+    unsigned triple = 0;
+    for (unsigned j = 0; j < ops_count; ++j) {
+      triple |= slotOperator(packedSlot(tree, number_count + j)) << (2 * j);
+    }
+    ++hits[triple];
+    const unsigned second = packedSlot(tree, number_count + 1);
+    const unsigned depth =
+        slotLhs(second) == number_count || slotRhs(second) == number_count ? 3
+                                                                           : 2;
+    if (depth < minDepth) {
+      minDepth = depth;
+    }
+  }
+  for (unsigned triple = 0; triple < operator_triples; ++triple) {
+    if (hits[triple] != features.tripleHits[triple]) {
+      printf("%s: %d: %d %d %d %d has %u trees of triple %u instead of %u\n",
+             __FILE__, __LINE__, numbers[0], numbers[1], numbers[2],
+             numbers[3], (unsigned)features.tripleHits[triple], triple,
+             hits[triple]);
+      result = 1;
+    }
+  }
+  if (state.size == 0) {
+    return;
+  }
+  if (features.minDepth != minDepth) {
+    printf("%s: %d: %d %d %d %d has depth %u instead of %u\n", __FILE__,
+           __LINE__, numbers[0], numbers[1], numbers[2], numbers[3],
+           (unsigned)features.minDepth, minDepth);
+    result = 1;
+  }
+  struct PuzzleFeatures expected;
+  computeFeatures(numbers, NULL, &expected);
+  if (features.required != expected.required ||
+      state.size != expected.solutions || features.fractional) {
+    printf("%s: %d: The features of %d %d %d %d don't match the generator\n",
+           __FILE__, __LINE__, numbers[0], numbers[1], numbers[2],
+           numbers[3]);
+    result = 1;
+  }
+}
+
+static void checkFractional(const int numbers[number_count], bool expected) {
+  struct SharedState state;
+  struct DifficultyFeatures features;
+  solveWithFeatures(numbers, &state, &features);
+  if (features.fractional != expected) {
+    printf("%s: %d: %d %d %d %d %s fractions\n", __FILE__, __LINE__,
+           numbers[0], numbers[1], numbers[2], numbers[3],
+           expected ? "doesn't need" : "needs");
+    result = 1;
+  }
+}
+
+int main() {
+  for (int a = 1; a <= 6; ++a) {
+    for (int b = a; b <= 6; ++b) {
+      for (int c = b; c <= 6; ++c) {
+        for (int d = c; d <= 6; ++d) {
+          checkFeatures((int[number_count]){a, b, c, d});
+        }
+      }
+    }
+  }
+  checkFeatures((int[number_count]){-7, 0, 12, 100});
+  checkFeatures((int[number_count]){13, 1, 12, 2});
+
+  // 8 / (3 - 8 / 3) and 5 * (5 - 1 / 5).
+  checkFractional((int[number_count]){3, 3, 8, 8}, true);
+  checkFractional((int[number_count]){1, 5, 5, 5}, true);
+  checkFractional((int[number_count]){1, 2, 3, 4}, false);
+  checkFractional((int[number_count]){1, 1, 1, 1}, false);
+  return result;
+}
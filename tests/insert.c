@@ -22,10 +22,9 @@ static void checkTreesAreSorted(struct SharedState *state) {
 }
 
 static void checkGenericInsert() {
-  struct SharedState state = (struct SharedState){
-      .seenTrees = xmalloc(sizeof(uint16_t) * initial_cache_size),
-      .size = 0,
-      .capacity = initial_cache_size};
+  struct NearMissHeap nearMisses = {.size = 0, .capacity = 0};
+  struct SharedState state;
+  initSharedState(&state, &nearMisses);
   enum { data_size = 14 };
   static const uint16_t data[data_size] = {9749, 8533,  1557,  6421, 4501,
                                            8725, 5653,  8725,  6677, 10325,
@@ -41,7 +40,19 @@ static void checkGenericInsert() {
       break;
     }
   }
-  free(state.seenTrees);
+  if (state.highWater != state.size) {
+    printf("%s: %d: Expected a high-water mark of %d, but found %d\n",
+           __FILE__, __LINE__, (int)state.size, (int)state.highWater);
+    result = 1;
+  }
+  // Resetting keeps the high-water mark.
+  state.size = 0;
+  insert(data[0], state.seenTrees, &state);
+  if (state.highWater != data_size - 1) {
+    printf("%s: %d: Expected a high-water mark of %d, but found %d\n",
+           __FILE__, __LINE__, data_size - 1, (int)state.highWater);
+    result = 1;
+  }
 }
 
 int main() {
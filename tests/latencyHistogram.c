@@ -0,0 +1,73 @@
+#define main xmain
+#include "../iteration2.c"
+
+#undef main
+
+int result = 0;
+
+static void checkBucketHolds(uint64_t value) {
+  const unsigned bucket = latencyBucket(value);
+  if (bucket >= latency_bucket_count || value < latencyBucketLow(bucket) ||
+      value > latencyBucketHigh(bucket)) {
+    printf("%s: %d: %" PRIu64 " isn't within its bucket %u\n", __FILE__,
+           __LINE__, value, bucket);
+    result = 1;
+  }
+}
+
+int main() {
+  // Buckets are contiguous and never wider than an eighth of their values.
+  for (unsigned i = 0; i + 1 < latency_bucket_count; ++i) {
+    const uint64_t low = latencyBucketLow(i), high = latencyBucketHigh(i);
+    if (latencyBucketLow(i + 1) != high + 1 ||
+        (high - low + 1) * latency_sub_buckets >
+            (low < latency_sub_buckets ? latency_sub_buckets : low)) {
+      printf("%s: %d: Bucket %u covers %" PRIu64 " - %" PRIu64 "\n", __FILE__,
+             __LINE__, i, low, high);
+      result = 1;
+    }
+  }
+  for (uint64_t value = 0; value < 100000; ++value) {
+    checkBucketHolds(value);
+  }
+  for (unsigned shift = 0; shift < 64; ++shift) {
+    checkBucketHolds((uint64_t)1 << shift);
+    checkBucketHolds(((uint64_t)1 << shift) - 1);
+    checkBucketHolds(((uint64_t)1 << shift) + 1);
+  }
+
+  // Merging per-thread histograms keeps every count and the extremes.
+  struct LatencyHistogram threads[2], merged;
+  memset(threads, 0, sizeof(threads));
+  memset(&merged, 0, sizeof(merged));
+  for (uint64_t i = 1; i <= 100; ++i) {
+    recordLatency(threads + i % 2, i * 1000);
+  }
+  mergeLatencies(&merged, threads);
+  mergeLatencies(&merged, threads + 1);
+  if (merged.total != 100 || merged.min != 1000 || merged.max != 100000 ||
+      merged.sum != 5050 * 1000) {
+    printf("%s: %d: Merged %" PRIu64 " values from %" PRIu64 " to %" PRIu64
+           " with sum %" PRIu64 "\n",
+           __FILE__, __LINE__, merged.total, merged.min, merged.max,
+           merged.sum);
+    result = 1;
+  }
+  // Percentiles overestimate by at most a bucket width.
+  static const struct {
+    double fraction;
+    uint64_t exact;
+  } expected[] = {{0.5, 50000}, {0.9, 90000}, {0.99, 99000}, {1, 100000}};
+  for (size_t i = 0; i < sizeof(expected) / sizeof(*expected); ++i) {
+    const uint64_t found = latencyPercentile(&merged, expected[i].fraction);
+    if (found < expected[i].exact ||
+        found > expected[i].exact + expected[i].exact / latency_sub_buckets) {
+      printf("%s: %d: Expected percentile %g near %" PRIu64 " but found %" PRIu64
+             "\n",
+             __FILE__, __LINE__, expected[i].fraction, expected[i].exact,
+             found);
+      result = 1;
+    }
+  }
+  return result;
+}
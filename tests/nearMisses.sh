@@ -0,0 +1,38 @@
+#!/bin/sh
+
+# Runs the nearest-miss mode end to end, on its own and in batch mode.
+
+PROG="$1"
+TMP="$(mktemp -d)" || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+RET=0
+for MODE in single batch
+do
+    if [ "$MODE" = batch ]
+    then
+	set -- -b
+    else
+	set --
+    fi
+
+    # Asking for near misses must not hide the solutions of a puzzle.
+    echo "1 2 3 4" | "$PROG" "$@" -k 3 >"$TMP/solvable.out"
+    if grep -q 'No solutions!' "$TMP/solvable.out" ||
+	    [ "$(grep -c '^(' "$TMP/solvable.out")" != 4 ]
+    then
+	echo "1 2 3 4 doesn't print its 4 solutions with -k in $MODE mode"
+	RET=1
+    fi
+
+    echo "1 1 1 1" | "$PROG" "$@" -k 3 >"$TMP/unsolvable.out"
+    if ! grep -q 'No solutions!' "$TMP/unsolvable.out" ||
+	    [ "$(grep -c ' = ' "$TMP/unsolvable.out")" != 3 ] ||
+	    ! grep -q '^(((1 + 1) + 1) + 1) = 4$' "$TMP/unsolvable.out"
+    then
+	echo "1 1 1 1 doesn't print its 3 nearest misses in $MODE mode"
+	RET=1
+    fi
+done
+
+exit "$RET"
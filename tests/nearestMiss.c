@@ -0,0 +1,105 @@
+#define main xmain
+#include "../iteration2.c"
+
+#undef main
+
+int result = 0;
+
+struct BruteForceState {
+  unsigned best;
+};
+
+static void bruteForceCallback(const SyntaxTree tree, const struct Node *root,
+                               void *data) {
+  const EvalResult res = evalSyntaxTree(tree, root);
+  struct BruteForceState *state = data;
+  if (res.valid) {
+    const unsigned distance = res.num > target_number
+                                  ? (unsigned)res.num - target_number
+                                  : (unsigned)(target_number - res.num);
+    if (distance < state->best) {
+      state->best = distance;
+    }
+  }
+}
+
+// Solves like main does and returns how many near misses were printed.
+static size_t solve(const int numbers[number_count], struct NearMissHeap *heap,
+                    struct SharedState *state) {
+  initSharedState(state, heap);
+  char output[8192];
+  FILE *out = fmemopen(output, sizeof(output), "w");
+  solvePuzzle(numbers, state, out);
+  fclose(out);
+  size_t printed = 0;
+  for (const char *pos = output; (pos = strstr(pos, " = ")); ++pos) {
+    ++printed;
+  }
+  return printed;
+}
+
+static void checkUnsolvable(int numbers[number_count], size_t k) {
+  struct NearMissHeap heap = {.size = 0, .capacity = k};
+  struct SharedState state;
+  const size_t printed = solve(numbers, &heap, &state);
+  if (state.size != 0) {
+    printf("%s: %d: Expected no solutions but found %d\n", __FILE__, __LINE__,
+           (int)state.size);
+    result = 1;
+    return;
+  }
+  if (heap.size != k || printed != k) {
+    printf("%s: %d: Expected %d near misses but found %d and printed %d\n",
+           __FILE__, __LINE__, (int)k, (int)heap.size, (int)printed);
+    result = 1;
+  }
+  // Printing the near misses sorted the heap.
+  struct BruteForceState brute = {.best = -1};
+  iterateAllSyntaxTrees(numbers, bruteForceCallback, &brute);
+  if (heap.size > 0 && heap.entries[0].distance != brute.best) {
+    printf("%s: %d: Expected closest distance %u but found %u\n", __FILE__,
+           __LINE__, brute.best, heap.entries[0].distance);
+    result = 1;
+  }
+  for (size_t i = 0; i < heap.size; ++i) {
+    const struct NearMiss *cur = heap.entries + i;
+    const EvalResult res = evalPackedTree(cur->tree, numbers, all_count - 1);
+    if (!res.valid || res.num != cur->value) {
+      printf("%s: %d: Near miss %d doesn't evaluate to %d\n", __FILE__,
+             __LINE__, (int)i, cur->value);
+      result = 1;
+    }
+    if (i > 0 && cur->distance < heap.entries[i - 1].distance) {
+      printf("%s: %d: Near misses %d and %d aren't sorted\n", __FILE__,
+             __LINE__, (int)i - 1, (int)i);
+      result = 1;
+    }
+    for (size_t j = 0; j < i; ++j) {
+      if (heap.entries[j].hash == cur->hash) {
+        printf("%s: %d: Near misses %d and %d are duplicates\n", __FILE__,
+               __LINE__, (int)j, (int)i);
+        result = 1;
+      }
+    }
+  }
+}
+
+static void checkSolvableRecordsNothingAfterHit() {
+  struct NearMissHeap heap = {.size = 0, .capacity = max_near_misses};
+  struct SharedState state;
+  // (1 + 2 + 3) * 4 = 24 is found with the very first operator triples.
+  solve((int[number_count]){1, 2, 3, 4}, &heap, &state);
+  if (state.size == 0) {
+    printf("%s: %d: Expected solutions for 1 2 3 4\n", __FILE__, __LINE__);
+    result = 1;
+  }
+}
+
+int main() {
+  checkUnsolvable((int[number_count]){1, 1, 1, 1}, 1);
+  checkUnsolvable((int[number_count]){1, 1, 1, 1}, 5);
+  checkUnsolvable((int[number_count]){1, 1, 2, 2}, max_near_misses);
+  checkUnsolvable((int[number_count]){1, 1, 1, 2}, 8);
+  checkSolvableRecordsNothingAfterHit();
+  return result;
+}
@@ -0,0 +1,111 @@
+#define main xmain
+#include "../iteration2.c"
+
+#undef main
+
+int result = 0;
+
+static struct TemplateCache full, minimal, rpn;
+
+// Evaluates an expression in reverse Polish notation.
+static EvalResult evalRpn(const char *text) {
+  int stack[number_count];
+  size_t depth = 0;
+  for (const char *pos = text; *pos;) {
+    if (*pos == ' ') {
+      ++pos;
+    } else if (classify(*pos) == char_digit ||
+               (*pos == '-' && classify(pos[1]) == char_digit)) {
+      stack[depth++] = (int)strtol(pos, (char **)&pos, 10);
+    } else {
+      const char *op = memchr(opChars, *pos++, sizeof(opChars));
+      const int rhs = stack[--depth], lhs = stack[--depth];
+      PackedTree tree = 0;
+      setPackedSlot(&tree, 0, makePackedNumber(0));
+      setPackedSlot(&tree, 1, makePackedNumber(1));
+      setPackedSlot(&tree, 2, makePackedOperator(op - opChars, 0, 1));
+      const EvalResult res = evalPackedTree(tree, (int[]){lhs, rhs}, 2);
+      if (!res.valid) {
+        return res;
+      }
+      stack[depth++] = res.num;
+    }
+  }
+  return makeNumber(stack[0]);
+}
+
+static void checkTree(PackedTree tree, const int numbers[], void *data) {
+  (void)data;
+  const EvalResult res = evalPackedTree(tree, numbers, all_count - 1);
+  char expected[128], line[template_line_size + 1];
+  FILE *out = fmemopen(expected, sizeof(expected), "w");
+  printPackedTreeImpl(out, tree, numbers, all_count - 1);
+  fclose(out);
+  line[renderTree(&full, tree, numbers, line)] = '\0';
+  if (strcmp(line, expected) != 0) {
+    printf("%s: %d: Rendered %s instead of %s\n", __FILE__, __LINE__, line,
+           expected);
+    result = 1;
+  }
+  // Minimal parentheses may let an inexact division cancel out, so only
+  // valid trees have to keep their value.
+  if (!res.valid) {
+    return;
+  }
+  line[renderTree(&minimal, tree, numbers, line)] = '\0';
+  struct KnownSolutions known;
+  initKnownSolutions(&known);
+  PackedTree parsed;
+  int value = target_number;
+  const enum Verdict verdict =
+      verifyAnswer(line, strlen(line), numbers, &known, &parsed, &value);
+  if ((verdict != verdict_correct && verdict != verdict_wrong) ||
+      value != res.num) {
+    printf("%s: %d: %s of %s doesn't evaluate to %d\n", __FILE__, __LINE__,
+           line, expected, res.num);
+    result = 1;
+  }
+  line[renderTree(&rpn, tree, numbers, line)] = '\0';
+  const EvalResult rpnRes = evalRpn(line);
+  if (!rpnRes.valid || rpnRes.num != res.num) {
+    printf("%s: %d: %s of %s doesn't evaluate to %d\n", __FILE__, __LINE__,
+           line, expected, res.num);
+    result = 1;
+  }
+}
+
+static void checkMinimal(const char *answer, const char *expected) {
+  struct AnswerParser parser = {.pos = answer,
+                                .end = answer + strlen(answer),
+                                .numberCount = 0,
+                                .operatorCount = 0,
+                                .nesting = 0,
+                                .overflow = false};
+  parseAnswerSum(&parser);
+  int numbers[number_count];
+  const PackedTree tree = packTree(parser.tree, numbers);
+  char line[template_line_size + 1];
+  line[renderTree(&minimal, tree, numbers, line)] = '\0';
+  if (strcmp(line, expected) != 0) {
+    printf("%s: %d: %s is printed as %s instead of %s\n", __FILE__, __LINE__,
+           answer, line, expected);
+    result = 1;
+  }
+}
+
+int main() {
+  initTemplateCache(&full, format_full);
+  initTemplateCache(&minimal, format_minimal);
+  initTemplateCache(&rpn, format_rpn);
+  iteratePackedTrees((int[number_count]){1, 2, 3, 4}, checkTree, NULL);
+  iteratePackedTrees((int[number_count]){-7, 0, 12, 100}, checkTree, NULL);
+  iteratePackedTrees((int[number_count]){-100, -1, 1, 8}, checkTree, NULL);
+  checkMinimal("(1 + 2) + (3 + 4)", "1 + 2 + 3 + 4");
+  checkMinimal("(1 - 2) - (3 - 4)", "1 - 2 - (3 - 4)");
+  checkMinimal("1 * (2 + 3) / 4", "1 * (2 + 3) / 4");
+  checkMinimal("(1 * 2) + (3 / 4)", "1 * 2 + 3 / 4");
+  checkMinimal("1 / (2 * (3 - 4))", "1 / (2 * (3 - 4))");
+  checkMinimal("(1 - (2 * 3)) + 4", "1 - 2 * 3 + 4");
+  checkMinimal("-1 - (-2 - -3) * 4", "-1 - (-2 - -3) * 4");
+  return result;
+}
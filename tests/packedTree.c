@@ -0,0 +1,51 @@
+#define main xmain
+#include "../iteration2.c"
+
+#undef main
+
+#include <limits.h>
+
+#include "common.inc"
+
+int result = 0;
+
+static void checkRoundTrip(PackedTree tree, const int numbers[], void *data) {
+  (void)data;
+  SyntaxTree unpacked;
+  unpackTree(tree, numbers, unpacked);
+  int repackedNumbers[number_count];
+  const PackedTree repacked = packTree(unpacked, repackedNumbers);
+  if (repacked != tree ||
+      memcmp(repackedNumbers, numbers, sizeof(repackedNumbers)) != 0) {
+    printf("%s: %d: Tree changed by unpacking and packing it again: ",
+           __FILE__, __LINE__);
+    debugPrintTree(unpacked);
+    result = 1;
+  }
+  unsigned char classes[number_count];
+  numberClasses(numbers, classes);
+  PackedTree canonical = tree;
+  canonicalizePackedTree(&canonical, classes);
+  canonicalizeTree(unpacked, unpacked + all_count - 1);
+  SyntaxTree canonicalUnpacked;
+  unpackTree(canonical, numbers, canonicalUnpacked);
+  if (!equalSyntaxTree(unpacked, canonicalUnpacked) ||
+      hashPackedTree(canonical) != hashTree(unpacked)) {
+    printf("%s: %d: Packed and unpacked canonicalization differ: ", __FILE__,
+           __LINE__);
+    debugPrintTree(unpacked);
+    debugPrintTree(canonicalUnpacked);
+    result = 1;
+  }
+}
+
+int main() {
+  if (sizeof(PackedTree) * CHAR_BIT < all_count * packed_slot_bits) {
+    printf("%s: %d: PackedTree can't hold %d slots\n", __FILE__, __LINE__,
+           (int)all_count);
+    result = 1;
+  }
+  iteratePackedTrees((int[number_count]){1, 2, 3, 4}, checkRoundTrip, NULL);
+  iteratePackedTrees((int[number_count]){7, 7, 2, 9}, checkRoundTrip, NULL);
+  return result;
+}
@@ -0,0 +1,151 @@
+#define main xmain
+#include "../iteration2.c"
+
+#undef main
+
+int result = 0;
+
+enum { test_low = 1, test_high = 7 };
+
+static void checkFeatures(const int numbers[number_count],
+                          const struct PuzzleFeatures *features) {
+  static struct NearMissHeap nearMisses;
+  struct SharedState state;
+  initSharedState(&state, &nearMisses);
+  state.out = NULL;
+  int sorted[number_count];
+  memcpy(sorted, numbers, sizeof(sorted));
+  countSolutions(sorted, &state);
+  if (features->solutions != state.size) {
+    printf("%s: %d: %d %d %d %d has %u solutions instead of %lu\n", __FILE__,
+           __LINE__, numbers[0], numbers[1], numbers[2], numbers[3],
+           (unsigned)features->solutions, (unsigned long)state.size);
+    result = 1;
+  }
+  if (features->solutions == 0) {
+    return;
+  }
+  const EvalResult res =
+      evalPackedTree(features->solution, numbers, all_count - 1);
+  if (!res.valid || res.num != target_number ||
+      (features->required & ~usedOperators(features->solution)) != 0) {
+    printf("%s: %d: The solution of %d %d %d %d doesn't fit its features\n",
+           __FILE__, __LINE__, numbers[0], numbers[1], numbers[2],
+           numbers[3]);
+    result = 1;
+  }
+}
+
+static void checkRequired(const int numbers[number_count],
+                          unsigned char expected) {
+  struct PuzzleFeatures features;
+  computeFeatures(numbers, NULL, &features);
+  if (features.required != expected) {
+    printf("%s: %d: %d %d %d %d requires operators %x instead of %x\n",
+           __FILE__, __LINE__, numbers[0], numbers[1], numbers[2], numbers[3],
+           (unsigned)features.required, (unsigned)expected);
+    result = 1;
+  }
+}
+
+static void checkCandidates(const struct FeatureIndex *index,
+                            const struct DifficultyProfile *profile) {
+  const uint64_t total = sweepSize(index->low, index->high);
+  struct GeneratorCandidate *candidates =
+      xmalloc(sizeof(struct GeneratorCandidate) * total);
+  const size_t count = collectCandidates(index, profile, candidates);
+  size_t expected = 0;
+  for (uint64_t rank = 0; rank < total; ++rank) {
+    expected += matchesProfile(index->features + rank, profile);
+  }
+  if (count != expected) {
+    printf("%s: %d: Collected %lu candidates instead of %lu\n", __FILE__,
+           __LINE__, (unsigned long)count, (unsigned long)expected);
+    result = 1;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    const uint64_t rank = rankQuadruple(candidates[i].numbers, index->low);
+    if (!matchesProfile(index->features + rank, profile) ||
+        candidates[i].solution != index->features[rank].solution) {
+      printf("%s: %d: Candidate %lu doesn't match the profile\n", __FILE__,
+             __LINE__, (unsigned long)i);
+      result = 1;
+    }
+  }
+  free(candidates);
+}
+
+int main() {
+  const uint64_t total = sweepSize(test_low, test_high);
+  struct FeatureIndex index = {
+      .low = test_low,
+      .high = test_high,
+      .features = xmalloc(sizeof(struct PuzzleFeatures) * total)};
+  struct ReachableCache *reachable = createReachableCache();
+  sweepFeatures(test_low, test_high, index.features, reachable);
+  free(reachable);
+  for (uint64_t rank = 0; rank < total; ++rank) {
+    int numbers[number_count];
+    unrankQuadruple(rank, test_low, test_high, numbers);
+    checkFeatures(numbers, index.features + rank);
+  }
+
+  FILE *saved = tmpfile();
+  writeFeatureIndex(saved, &index);
+  rewind(saved);
+  struct FeatureIndex reloaded = {
+      .low = test_low,
+      .high = test_high,
+      .features = xmalloc(sizeof(struct PuzzleFeatures) * total)};
+  bool valid = readFeatureIndex(saved, &reloaded);
+  for (uint64_t rank = 0; rank < total && valid; ++rank) {
+    valid = reloaded.features[rank].solution == index.features[rank].solution &&
+            reloaded.features[rank].solutions ==
+                index.features[rank].solutions &&
+            reloaded.features[rank].required == index.features[rank].required;
+  }
+  if (!valid) {
+    printf("%s: %d: The index doesn't survive a reload\n", __FILE__, __LINE__);
+    result = 1;
+  }
+  rewind(saved);
+  reloaded.high = test_high + 1;
+  if (readFeatureIndex(saved, &reloaded)) {
+    printf("%s: %d: The index is read for another range\n", __FILE__,
+           __LINE__);
+    result = 1;
+  }
+  fclose(saved);
+  free(reloaded.features);
+
+  // 9 * (1 + 7) / 3 is the only solution.
+  checkRequired((int[number_count]){1, 3, 7, 9},
+                1u << op_add | 1u << op_mul | 1u << op_div);
+  checkRequired((int[number_count]){1, 1, 1, 1}, 0);
+  checkRequired((int[number_count]){1, 2, 3, 4}, 1u << op_mul);
+
+  const struct DifficultyProfile profiles[] = {
+      {.minSolutions = 1, .maxSolutions = max_canonical_solutions,
+       .required = 0},
+      {.minSolutions = 0, .maxSolutions = 0, .required = 0},
+      {.minSolutions = 1, .maxSolutions = 1, .required = 1u << op_div},
+      {.minSolutions = 2, .maxSolutions = 5, .required = 1u << op_mul}};
+  for (size_t i = 0; i < sizeof(profiles) / sizeof(*profiles); ++i) {
+    checkCandidates(&index, profiles + i);
+  }
+  free(index.features);
+
+  uint64_t seed = 24;
+  unsigned hits[7] = {0};
+  for (int i = 0; i < 7000; ++i) {
+    ++hits[randomBelow(&seed, 7)];
+  }
+  for (int i = 0; i < 7; ++i) {
+    if (hits[i] < 800 || hits[i] > 1200) {
+      printf("%s: %d: %d was drawn %u times out of 7000\n", __FILE__,
+             __LINE__, i, hits[i]);
+      result = 1;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,111 @@
+#define main xmain
+#include "../iteration2.c"
+
+#undef main
+
+int result = 0;
+
+static bool sameReachable(const struct ReachableSet *lhs,
+                          const struct ReachableSet *rhs) {
+  return lhs->count == rhs->count && lhs->size == rhs->size &&
+         memcmp(lhs->numbers, rhs->numbers, sizeof(int) * lhs->count) == 0 &&
+         memcmp(lhs->values, rhs->values, sizeof(int) * lhs->size) == 0;
+}
+
+static void checkPuzzle(struct ReachableCache *cache,
+                        int numbers[number_count]) {
+  static struct NearMissHeap nearMisses;
+  struct SharedState state;
+  initSharedState(&state, &nearMisses);
+  state.out = NULL;
+  countSolutions(numbers, &state);
+  const bool found = reachableTarget(cache, numbers);
+  if (found != (state.size > 0)) {
+    printf("%s: %d: %d %d %d %d has %d solutions but the cache says %d\n",
+           __FILE__, __LINE__, numbers[0], numbers[1], numbers[2], numbers[3],
+           (int)state.size, found);
+    result = 1;
+  }
+}
+
+// Pairs of triples that share an entry, so the threads keep replacing each
+// other's entries while they read them.
+enum { max_colliding = 64 };
+static int colliding[max_colliding][3];
+static size_t collidingCount = 0;
+
+static void findCollisions(void) {
+  static int firstInSlot[reachable_cache_size][3];
+  static bool used[reachable_cache_size];
+  for (int a = 1; a <= 60 && collidingCount < max_colliding; ++a) {
+    for (int b = a; b <= 60 && collidingCount < max_colliding; ++b) {
+      for (int c = b; c <= 60 && collidingCount < max_colliding; ++c) {
+        const int numbers[3] = {a, b, c};
+        const size_t slot = reachableSlot(numbers, 3);
+        if (!used[slot]) {
+          used[slot] = true;
+          memcpy(firstInSlot[slot], numbers, sizeof(numbers));
+        } else if (firstInSlot[slot][0] != 0) {
+          memcpy(colliding[collidingCount++], firstInSlot[slot],
+                 sizeof(numbers));
+          memcpy(colliding[collidingCount++], numbers, sizeof(numbers));
+          firstInSlot[slot][0] = 0;
+        }
+      }
+    }
+  }
+}
+
+static void *hammerCache(void *data) {
+  struct ReachableCache *cache = data;
+  for (int round = 0; round < 100; ++round) {
+    for (size_t i = 0; i < collidingCount; ++i) {
+      struct ReachableSet cached, computed;
+      getReachable(cache, colliding[i], 3, &cached);
+      computeReachable(colliding[i], 3, &computed);
+      if (!sameReachable(&cached, &computed)) {
+        printf("%s: %d: Torn entry for %d %d %d\n", __FILE__, __LINE__,
+               colliding[i][0], colliding[i][1], colliding[i][2]);
+        result = 1;
+        return NULL;
+      }
+    }
+  }
+  return NULL;
+}
+
+int main() {
+  struct ReachableCache *cache = createReachableCache();
+  for (int a = -1; a <= 10; ++a) {
+    for (int b = a; b <= 10; ++b) {
+      for (int c = b; c <= 10; ++c) {
+        for (int d = c; d <= 10; ++d) {
+          checkPuzzle(cache, (int[]){a, b, c, d});
+        }
+      }
+    }
+  }
+  if (cache->hits == 0 || cache->hits >= cache->lookups) {
+    printf("%s: %d: Expected some hits but got %" PRIu64 " of %" PRIu64 "\n",
+           __FILE__, __LINE__, cache->hits, cache->lookups);
+    result = 1;
+  }
+  free(cache);
+
+  findCollisions();
+  if (collidingCount != max_colliding) {
+    printf("%s: %d: Found only %d colliding triples\n", __FILE__, __LINE__,
+           (int)collidingCount);
+    result = 1;
+  }
+  cache = createReachableCache();
+  pthread_t threads[4];
+  for (int i = 0; i < 4; ++i) {
+    pthread_create(threads + i, NULL, hammerCache, cache);
+  }
+  for (int i = 0; i < 4; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  free(cache);
+  return result;
+}
@@ -0,0 +1,138 @@
+#define main xmain
+#include "../iteration2.c"
+
+#undef main
+
+int result = 0;
+
+static struct RealNumber decimal(const char *text) {
+  struct RealNumber number;
+  if (parseDecimal(text, &number)) {
+    printf("%s: %d: Can't parse %s\n", __FILE__, __LINE__, text);
+    result = 1;
+  }
+  return number;
+}
+
+// The kernel has to flag every tree that exactly reaches the target, and
+// the solver has to report exactly the classes of those trees.
+static void checkPuzzle(const char *const texts[number_count],
+                        const char *target) {
+  struct RealPuzzle puzzle = {.target = decimal(target), .epsilon = 1e-6};
+  for (int i = 0; i < number_count; ++i) {
+    puzzle.numbers[i] = decimal(texts[i]);
+  }
+  static struct NearMissHeap nearMisses;
+  struct SharedState state;
+  initSharedState(&state, &nearMisses);
+  char output[8192];
+  FILE *out = fmemopen(output, sizeof(output), "w");
+  if (solveRealPuzzle(&puzzle, &state, out) != 0) {
+    printf("%s: %d: %s %s %s %s has candidates that can't be checked\n",
+           __FILE__, __LINE__, texts[0], texts[1], texts[2], texts[3]);
+    result = 1;
+  }
+  fclose(out);
+
+  static uint64_t matches[wiring_count];
+  findRealCandidates(&puzzle, matches);
+  unsigned char classes[number_count];
+  realNumberClasses(puzzle.numbers, classes);
+  uint16_t expected[max_canonical_solutions];
+  size_t expectedCount = 0;
+  for (unsigned combination = 0; combination < tree_count; ++combination) {
+    const PackedTree tree = packedTreeAt(combination);
+    struct Rational value;
+    if (evalRationalTree(tree, puzzle.numbers, all_count - 1, &value) !=
+            exact_value ||
+        value.num != puzzle.target.exact.num ||
+        value.den != puzzle.target.exact.den) {
+      continue;
+    }
+    if (!(matches[combination % wiring_count] >>
+              (combination / wiring_count) &
+          1)) {
+      printf("%s: %d: Kernel missed tree %u of %s %s %s %s\n", __FILE__,
+             __LINE__, combination, texts[0], texts[1], texts[2], texts[3]);
+      result = 1;
+    }
+    const uint16_t hash = canonicalSignature(tree, classes);
+    uint16_t *end = expected + expectedCount,
+             *pos = upperBound(expected, end, hash);
+    if (pos == end || *pos != hash) {
+      memmove(pos + 1, pos, (end - pos) * sizeof(uint16_t));
+      *pos = hash;
+      ++expectedCount;
+    }
+  }
+  if (state.size != expectedCount ||
+      memcmp(state.seenTrees, expected, sizeof(uint16_t) * expectedCount)) {
+    printf("%s: %d: %s %s %s %s has %lu solutions instead of %lu\n%s",
+           __FILE__, __LINE__, texts[0], texts[1], texts[2], texts[3],
+           (unsigned long)state.size, (unsigned long)expectedCount, output);
+    result = 1;
+  }
+}
+
+// Candidates whose exact value doesn't fit have to be reported instead of
+// being dropped.
+static void checkOverflow(const char *const texts[number_count],
+                          const char *target) {
+  struct RealPuzzle puzzle = {.target = decimal(target), .epsilon = 1e-6};
+  for (int i = 0; i < number_count; ++i) {
+    puzzle.numbers[i] = decimal(texts[i]);
+  }
+  static struct NearMissHeap nearMisses;
+  struct SharedState state;
+  initSharedState(&state, &nearMisses);
+  char output[8192];
+  FILE *out = fmemopen(output, sizeof(output), "w");
+  const unsigned unchecked = solveRealPuzzle(&puzzle, &state, out);
+  fclose(out);
+  if (unchecked == 0) {
+    printf("%s: %d: %s %s %s %s didn't report its unchecked candidates\n",
+           __FILE__, __LINE__, texts[0], texts[1], texts[2], texts[3]);
+    result = 1;
+  }
+}
+
+static void checkDecimal(const char *text, const char *expected) {
+  struct RealNumber number;
+  char printed[64] = "invalid";
+  if (!parseDecimal(text, &number)) {
+    FILE *out = fmemopen(printed, sizeof(printed), "w");
+    printDecimal(out, &number);
+    fclose(out);
+  }
+  if (strcmp(printed, expected) != 0) {
+    printf("%s: %d: %s printed as %s instead of %s\n", __FILE__, __LINE__,
+           text, printed, expected);
+    result = 1;
+  }
+}
+
+int main() {
+  checkPuzzle((const char *const[]){"3", "3", "8", "8"}, "24");
+  checkPuzzle((const char *const[]){"1", "5", "5", "5"}, "24");
+  checkPuzzle((const char *const[]){"0.1", "0.2", "0.3", "1"}, "0.6");
+  checkPuzzle((const char *const[]){"0.25", "1.5", "2", "4"}, "12.5");
+  checkPuzzle((const char *const[]){"-0.5", "0", "0", "3"}, "-1.5");
+  checkPuzzle((const char *const[]){"0.000001", "999999", "7", "1"}, "1");
+  checkPuzzle((const char *const[]){"1", "3", "4", "6"}, "24");
+  // 999999999999 * 999999999999 / (999999999999 * 999999999999).
+  checkOverflow((const char *const[]){"999999999999", "999999999999",
+                                      "999999999999", "999999999999"},
+                "1");
+  checkDecimal("1.50", "1.5");
+  checkDecimal("-0.25", "-0.25");
+  checkDecimal("+7", "7");
+  checkDecimal("-0", "0");
+  checkDecimal("3.", "3");
+  checkDecimal(".5", "0.5");
+  checkDecimal("0.0000001", "invalid");
+  checkDecimal("1234567890123", "invalid");
+  checkDecimal("-", "invalid");
+  checkDecimal("1.2.3", "invalid");
+  checkDecimal("1e3", "invalid");
+  return result;
+}
@@ -0,0 +1,46 @@
+#define main xmain
+#include "../iteration3.c"
+
+#undef main
+
+int result = 0;
+
+static enum CallbackRet stopAtHitCallback(const SyntaxTree tree,
+                                          const struct Node *root,
+                                          void *data) {
+  (void)data;
+  return isSolution(tree, root) ? Stop : Continue;
+}
+
+// The learned order must find a solution exactly when the numbering order
+// does.
+static void checkSameSolvability(const int numbers[number_count],
+                                 void *data) {
+  (void)data;
+  const enum CallbackRet fixed = iterateAllSyntaxTrees(
+                             numbers, NULL, stopAtHitCallback, NULL),
+                         learned = iterateAllSyntaxTrees(
+                             numbers, searchOrder, stopAtHitCallback, NULL);
+  if (fixed != learned) {
+    printf("%s: %d: The orders disagree on whether %d %d %d %d is solvable\n",
+           __FILE__, __LINE__, numbers[0], numbers[1], numbers[2], numbers[3]);
+    result = 1;
+  }
+}
+
+int main() {
+  // The learned order must visit every tree exactly once.
+  static bool seen[tree_count];
+  for (unsigned i = 0; i < tree_count; ++i) {
+    if (searchOrder[i] >= tree_count || seen[searchOrder[i]]) {
+      printf("%s: %d: Entry %u of the search order is %u, which is out of "
+             "range or repeated\n",
+             __FILE__, __LINE__, i, (unsigned)searchOrder[i]);
+      result = 1;
+    } else {
+      seen[searchOrder[i]] = true;
+    }
+  }
+  iterateQuadruples(1, 9, checkSameSolvability, NULL);
+  return result;
+}
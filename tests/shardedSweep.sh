@@ -0,0 +1,78 @@
+#!/bin/sh
+
+# Checks that merging the shards of a sweep gives the result of the whole
+# sweep, that incomplete or overlapping shards are rejected, and that resuming
+# from a checkpoint gives the same result as an uninterrupted sweep.
+
+PROG="$1"
+TMP="$(mktemp -d)" || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+RET=0
+"$PROG" --sweep 1 7 >"$TMP/full.out" || RET=1
+if [ "$(grep -c '^solutions ' "$TMP/full.out")" = 0 ]
+then
+    echo "Sweep produced no histogram"
+    RET=1
+fi
+
+for SHARDS in 1 3 5
+do
+    SHARD=0
+    FILES=
+    while [ "$SHARD" -lt "$SHARDS" ]
+    do
+	"$PROG" --sweep 1 7 --shard "$SHARD/$SHARDS" >"$TMP/$SHARD.out" || RET=1
+	# Merging is independent of the order of the shards.
+	FILES="$TMP/$SHARD.out $FILES"
+	SHARD=$((SHARD + 1))
+    done
+    if ! "$PROG" --merge $FILES | cmp - "$TMP/full.out"
+    then
+	echo "Merging $SHARDS shards differs from the whole sweep"
+	RET=1
+    fi
+done
+
+if "$PROG" --merge "$TMP/0.out" "$TMP/2.out" >/dev/null 2>&1
+then
+    echo "Merging with a missing shard was accepted"
+    RET=1
+fi
+if "$PROG" --merge "$TMP/0.out" "$TMP/1.out" "$TMP/1.out" "$TMP/2.out" \
+	   "$TMP/3.out" "$TMP/4.out" >/dev/null 2>&1
+then
+    echo "Merging overlapping shards was accepted"
+    RET=1
+fi
+head -n 3 "$TMP/full.out" >"$TMP/truncated.out"
+if "$PROG" --merge "$TMP/truncated.out" >/dev/null 2>&1
+then
+    echo "Merging a truncated result was accepted"
+    RET=1
+fi
+
+# The first half of a sweep is also a checkpoint of the whole sweep.
+"$PROG" --sweep 1 7 --shard 0/2 >"$TMP/checkpoint" || RET=1
+if ! "$PROG" --sweep 1 7 --checkpoint "$TMP/checkpoint" >"$TMP/resumed.out" ||
+	! cmp "$TMP/resumed.out" "$TMP/full.out" ||
+	! cmp "$TMP/checkpoint" "$TMP/full.out"
+then
+    echo "Resuming from a checkpoint differs from the whole sweep"
+    RET=1
+fi
+if "$PROG" --sweep 1 7 --shard 1/2 --checkpoint "$TMP/checkpoint" \
+	   >/dev/null 2>&1
+then
+    echo "A checkpoint of another shard was accepted"
+    RET=1
+fi
+rm -f "$TMP/fresh"
+if ! "$PROG" --sweep 1 7 --checkpoint "$TMP/fresh" | cmp - "$TMP/full.out" ||
+	! cmp "$TMP/fresh" "$TMP/full.out"
+then
+    echo "Sweeping with a new checkpoint differs from the whole sweep"
+    RET=1
+fi
+
+exit "$RET"
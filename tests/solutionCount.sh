@@ -4,7 +4,7 @@ RET=0
 
 while read N1 N2 N3 N4 EXP
 do
-    if ! ACT="$("$2" <<<"$N1 $N2 $N3 $N4" | wc -l)"
+    if ! ACT="$(echo "$N1 $N2 $N3 $N4" | "$2" | wc -l)"
     then
 	echo "Error analyzing output for $1 $2 $3 $4"
 	exit 1
@@ -0,0 +1,95 @@
+#define main xmain
+#include "../iteration2.c"
+
+#undef main
+
+int result = 0;
+
+// Pages through the solutions of numbers, saving and reloading the cursor
+// after every page, and prints them to out.
+static void printPages(FILE *out, const int numbers[number_count],
+                       size_t pageSize) {
+  struct SolutionCursor cursor;
+  openSolutionCursor(&cursor, numbers);
+  PackedTree solutions[max_canonical_solutions];
+  size_t found;
+  do {
+    found = nextSolutions(&cursor, pageSize, solutions);
+    for (size_t i = 0; i < found; ++i) {
+      printPackedTree(out, solutions[i], cursor.numbers);
+    }
+    FILE *saved = tmpfile();
+    writeSolutionCursor(saved, &cursor);
+    rewind(saved);
+    struct SolutionCursor reloaded;
+    if (!readSolutionCursor(saved, &reloaded) ||
+        memcmp(reloaded.numbers, cursor.numbers, sizeof(cursor.numbers)) ||
+        reloaded.next != cursor.next ||
+        reloaded.seenCount != cursor.seenCount ||
+        memcmp(reloaded.seen, cursor.seen,
+               sizeof(uint16_t) * cursor.seenCount) != 0) {
+      printf("%s: %d: Cursor of %d %d %d %d doesn't survive a reload\n",
+             __FILE__, __LINE__, numbers[0], numbers[1], numbers[2],
+             numbers[3]);
+      result = 1;
+    }
+    fclose(saved);
+    cursor = reloaded;
+  } while (found == pageSize);
+  if (cursor.seenCount == 0) {
+    fputs("No solutions!\n", out);
+  }
+}
+
+static void checkPuzzle(const int numbers[number_count]) {
+  static char expected[8192], paged[8192];
+  static struct NearMissHeap nearMisses;
+  struct SharedState state;
+  initSharedState(&state, &nearMisses);
+  FILE *out = fmemopen(expected, sizeof(expected), "w");
+  solvePuzzle(numbers, &state, out);
+  fclose(out);
+  const size_t pageSizes[] = {1, 3, max_canonical_solutions};
+  for (size_t i = 0; i < sizeof(pageSizes) / sizeof(*pageSizes); ++i) {
+    out = fmemopen(paged, sizeof(paged), "w");
+    printPages(out, numbers, pageSizes[i]);
+    fclose(out);
+    if (strcmp(expected, paged) != 0) {
+      printf("%s: %d: Pages of %lu differ for %d %d %d %d:\n%s---\n%s",
+             __FILE__, __LINE__, (unsigned long)pageSizes[i], numbers[0],
+             numbers[1], numbers[2], numbers[3], expected, paged);
+      result = 1;
+    }
+  }
+}
+
+static void checkMalformed(const char *text) {
+  FILE *in = fmemopen((void *)text, strlen(text), "r");
+  struct SolutionCursor cursor;
+  if (readSolutionCursor(in, &cursor)) {
+    printf("%s: %d: Accepted malformed cursor:\n%s", __FILE__, __LINE__, text);
+    result = 1;
+  }
+  fclose(in);
+}
+
+int main() {
+  for (int a = 1; a <= 8; ++a) {
+    for (int b = a; b <= 8; ++b) {
+      for (int c = b; c <= 8; ++c) {
+        for (int d = c; d <= 8; ++d) {
+          checkPuzzle((const int[number_count]){d, b, a, c});
+        }
+      }
+    }
+  }
+  // Version 1 numbered the trees differently and version 2 signed solutions
+  // without their numbers.
+  checkMalformed("game24-cursor 1\nnumbers 1 2 3 4\nnext 0\nseen 0\nend\n");
+  checkMalformed("game24-cursor 2\nnumbers 1 2 3 4\nnext 0\nseen 0\nend\n");
+  checkMalformed("game24-cursor 3\nnumbers 4 3 2 1\nnext 0\nseen 0\nend\n");
+  checkMalformed("game24-cursor 3\nnumbers 1 2 3 4\nnext 99999\nseen 0\nend\n");
+  checkMalformed("game24-cursor 3\nnumbers 1 2 3 4\nnext 5\nseen 2 9 9\nend\n");
+  checkMalformed("game24-cursor 3\nnumbers 1 2 3 4\nnext 5\nseen 1 9\n");
+  return result;
+}
@@ -0,0 +1,69 @@
+#define main xmain
+#include "../iteration2.c"
+
+#undef main
+
+int main() {
+  int result = 0;
+  const int low = 3, high = 11;
+  uint64_t rank = 0;
+  int numbers[number_count];
+  for (int a = low; a <= high; ++a) {
+    for (int b = a; b <= high; ++b) {
+      for (int c = b; c <= high; ++c) {
+        for (int d = c; d <= high; ++d, ++rank) {
+          const int expected[number_count] = {a, b, c, d};
+          if (rankQuadruple(expected, low) >= sweepSize(low, high)) {
+            printf("%s: %d: Rank of %d %d %d %d is out of range\n", __FILE__,
+                   __LINE__, a, b, c, d);
+            result = 1;
+          }
+          unrankQuadruple(rankQuadruple(expected, low), low, high, numbers);
+          if (memcmp(numbers, expected, sizeof(numbers)) != 0) {
+            printf("%s: %d: Expected %d %d %d %d to round trip, but got "
+                   "%d %d %d %d\n",
+                   __FILE__, __LINE__, a, b, c, d, numbers[0], numbers[1],
+                   numbers[2], numbers[3]);
+            result = 1;
+          }
+        }
+      }
+    }
+  }
+  if (rank != sweepSize(low, high)) {
+    printf("%s: %d: Expected %lu quadruples, but found %lu\n", __FILE__,
+           __LINE__, (unsigned long)sweepSize(low, high), (unsigned long)rank);
+    result = 1;
+  }
+  // Ranks are dense, so each rank maps to a distinct sorted quadruple.
+  for (uint64_t i = 0; i < sweepSize(low, high); ++i) {
+    unrankQuadruple(i, low, high, numbers);
+    if (rankQuadruple(numbers, low) != i ||
+        !(low <= numbers[0] && numbers[0] <= numbers[1] &&
+          numbers[1] <= numbers[2] && numbers[2] <= numbers[3] &&
+          numbers[3] <= high)) {
+      printf("%s: %d: Rank %lu doesn't round trip\n", __FILE__, __LINE__,
+             (unsigned long)i);
+      result = 1;
+    }
+  }
+  // The widest sweep must not overflow.
+  const uint64_t widest = sweepSize(0, max_sweep_values - 1);
+  unrankQuadruple(widest - 1, 0, max_sweep_values - 1, numbers);
+  if (numbers[0] != max_sweep_values - 1 ||
+      rankQuadruple(numbers, 0) != widest - 1) {
+    printf("%s: %d: The last rank of the widest sweep doesn't round trip\n",
+           __FILE__, __LINE__);
+    result = 1;
+  }
+  // Shards split the ranks without gaps.
+  for (unsigned shards = 1; shards < 10; ++shards) {
+    if (shardBegin(rank, 0, shards) != 0 ||
+        shardBegin(rank, shards, shards) != rank) {
+      printf("%s: %d: %u shards don't cover all ranks\n", __FILE__, __LINE__,
+             shards);
+      result = 1;
+    }
+  }
+  return result;
+}
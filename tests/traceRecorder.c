@@ -0,0 +1,156 @@
+#define main xmain
+#include "../iteration2.c"
+
+#undef main
+
+int result = 0;
+
+static const char *const tracePath = "traceRecorder.trace";
+
+static const int puzzles[][number_count] = {
+    {1, 2, 3, 4}, {1, 1, 1, 1}, {4, 4, 10, 10}, {3, 3, 8, 8}, {12, 12, 12, 12}};
+enum { puzzle_count = sizeof(puzzles) / sizeof(*puzzles), rounds = 3 };
+
+struct Solver {
+  struct TraceWriter *writer;
+  struct ReachableCache *reachable;
+  size_t solutions;
+};
+
+static void *solveAll(void *data) {
+  struct Solver *solver = data;
+  static struct NearMissHeap nearMisses;
+  struct SharedState state;
+  initSharedState(&state, &nearMisses);
+  state.out = NULL;
+  state.reachable = solver->reachable;
+  state.trace = claimTraceRecorder(solver->writer);
+  for (int round = 0; round < rounds; ++round) {
+    for (size_t i = 0; i < puzzle_count; ++i) {
+      int numbers[number_count];
+      memcpy(numbers, puzzles[i], sizeof(numbers));
+      countSolutions(numbers, &state);
+      solver->solutions += state.size;
+    }
+  }
+  return NULL;
+}
+
+// Checks every decoded tree against the tree its number stands for.
+static void checkDecoded(FILE *decoded, unsigned threads, size_t solutions) {
+  int numbers[max_trace_threads][number_count];
+  size_t accepted = 0, puzzleCount = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), decoded)) {
+    unsigned thread, number;
+    int offset, puzzle[number_count];
+    if (sscanf(line, "%u puzzle %d %d %d %d", &thread, puzzle, puzzle + 1,
+               puzzle + 2, puzzle + 3) == 5 &&
+        thread < threads) {
+      memcpy(numbers[thread], puzzle, sizeof(puzzle));
+      ++puzzleCount;
+      continue;
+    }
+    if (sscanf(line, "%u skipped", &thread) == 1 &&
+        strstr(line, "skipped")) {
+      continue;
+    }
+    if (sscanf(line, "%u tree %u %n", &thread, &number, &offset) != 2 ||
+        thread >= threads || number >= tree_count) {
+      printf("%s: %d: Can't parse %s", __FILE__, __LINE__, line);
+      result = 1;
+      break;
+    }
+    const PackedTree tree = packedTreeAt(number);
+    const EvalResult res = evalPackedTree(tree, numbers[thread], all_count - 1);
+    char expected[128];
+    FILE *out = fmemopen(expected, sizeof(expected), "w");
+    printPackedTreeImpl(out, tree, numbers[thread], all_count - 1);
+    if (res.valid) {
+      fprintf(out, " = %d", res.num);
+    } else {
+      fputs(" invalid", out);
+    }
+    fclose(out);
+    if (strncmp(line + offset, expected, strlen(expected)) != 0) {
+      printf("%s: %d: Decoded %sinstead of %s\n", __FILE__, __LINE__, line,
+             expected);
+      result = 1;
+    }
+    accepted += strstr(line, " accepted") != NULL;
+  }
+  if (puzzleCount != threads * rounds * puzzle_count ||
+      accepted != solutions) {
+    printf("%s: %d: Decoded %lu puzzles with %lu solutions instead of %lu "
+           "with %lu\n",
+           __FILE__, __LINE__, (unsigned long)puzzleCount,
+           (unsigned long)accepted,
+           (unsigned long)(threads * rounds * puzzle_count),
+           (unsigned long)solutions);
+    result = 1;
+  }
+}
+
+static void checkTrace(unsigned threads) {
+  struct TraceWriter writer;
+  if (openTraceWriter(&writer, tracePath, threads)) {
+    result = 1;
+    return;
+  }
+  struct ReachableCache *reachable = createReachableCache();
+  struct Solver solvers[2];
+  pthread_t handles[2];
+  for (unsigned i = 0; i < threads; ++i) {
+    solvers[i] = (struct Solver){
+        .writer = &writer, .reachable = reachable, .solutions = 0};
+    pthread_create(handles + i, NULL, solveAll, solvers + i);
+  }
+  size_t solutions = 0;
+  for (unsigned i = 0; i < threads; ++i) {
+    pthread_join(handles[i], NULL);
+    solutions += solvers[i].solutions;
+  }
+  free(reachable);
+  if (closeTraceWriter(&writer)) {
+    result = 1;
+    return;
+  }
+
+  FILE *in = fopen(tracePath, "rb");
+  FILE *decoded = tmpfile();
+  if (!decodeTrace(in, decoded)) {
+    printf("%s: %d: Can't decode the trace of %u threads\n", __FILE__,
+           __LINE__, threads);
+    result = 1;
+  }
+  rewind(decoded);
+  checkDecoded(decoded, threads, solutions);
+  fclose(decoded);
+
+  // Dropping the last event leaves an incomplete block.
+  fseek(in, 0, SEEK_END);
+  const long size = ftell(in);
+  rewind(in);
+  char *contents = xmalloc(size);
+  if (fread(contents, 1, size, in) != (size_t)size) {
+    result = 1;
+  }
+  fclose(in);
+  FILE *truncated =
+      fmemopen(contents, size - sizeof(struct TraceEvent), "rb");
+  FILE *sink = fopen("/dev/null", "w");
+  if (decodeTrace(truncated, sink)) {
+    printf("%s: %d: Decoded a truncated trace\n", __FILE__, __LINE__);
+    result = 1;
+  }
+  fclose(sink);
+  fclose(truncated);
+  free(contents);
+  remove(tracePath);
+}
+
+int main() {
+  checkTrace(1);
+  checkTrace(2);
+  return result;
+}
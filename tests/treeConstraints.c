@@ -0,0 +1,92 @@
+#define main xmain
+#include "../iteration2.c"
+
+#undef main
+
+int result = 0;
+
+struct TreeList {
+  size_t size;
+  PackedTree trees[tree_count];
+};
+
+static void collectTree(PackedTree tree, const int numbers[], void *data) {
+  (void)numbers;
+  struct TreeList *list = data;
+  list->trees[list->size++] = tree;
+}
+
+static unsigned treeDepth(PackedTree tree, unsigned idx) {
+  const unsigned slot = packedSlot(tree, idx);
+  if (slotKind(slot) == node_number) {
+    return 0;
+  }
+  const unsigned lhs = treeDepth(tree, slotLhs(slot)),
+                 rhs = treeDepth(tree, slotRhs(slot));
+  return 1 + (lhs > rhs ? lhs : rhs);
+}
+
+// Checks the constraints on a finished tree.
+static bool satisfies(PackedTree tree,
+                      const struct TreeConstraints *constraints) {
+  unsigned used = 0;
+  bool leftDeep = true;
+  for (unsigned idx = number_count; idx < all_count; ++idx) {
+    const unsigned slot = packedSlot(tree, idx);
+    used |= 1u << slotOperator(slot);
+    if (idx > number_count &&
+        (slotLhs(slot) != idx - 1 || slotRhs(slot) >= number_count)) {
+      leftDeep = false;
+    }
+  }
+  return (used & ~constraints->operators) == 0 &&
+         (constraints->required & ~used) == 0 &&
+         treeDepth(tree, all_count - 1) <= constraints->maxDepth &&
+         (leftDeep || !constraints->leftDeep);
+}
+
+int main() {
+  static struct TreeList all, constrained;
+  const int numbers[number_count] = {1, 2, 3, 4};
+  iteratePackedTrees(numbers, collectTree, &all);
+  for (unsigned operators = 0; operators < 16; ++operators) {
+    for (unsigned required = 0; required < 16; ++required) {
+      for (unsigned char depth = 1; depth <= ops_count; ++depth) {
+        for (int leftDeep = 0; leftDeep < 2; ++leftDeep) {
+          const struct TreeConstraints constraints = {
+              .operators = operators,
+              .required = required,
+              .maxDepth = depth,
+              .leftDeep = leftDeep};
+          constrained.size = 0;
+          iterateConstrainedTrees(numbers, &constraints, collectTree,
+                                  &constrained);
+          // The constrained trees have to come in the same order.
+          size_t matched = 0;
+          for (size_t i = 0; i < all.size; ++i) {
+            if (!satisfies(all.trees[i], &constraints)) {
+              continue;
+            }
+            if (matched >= constrained.size ||
+                constrained.trees[matched] != all.trees[i]) {
+              break;
+            }
+            ++matched;
+          }
+          size_t expected = 0;
+          for (size_t i = 0; i < all.size; ++i) {
+            expected += satisfies(all.trees[i], &constraints);
+          }
+          if (expected != matched || expected != constrained.size) {
+            printf("%s: %d: Operators %x, required %x, depth %d and left "
+                   "deep %d visit %lu trees in order instead of %lu\n",
+                   __FILE__, __LINE__, operators, required, depth, leftDeep,
+                   (unsigned long)constrained.size, (unsigned long)expected);
+            result = 1;
+          }
+        }
+      }
+    }
+  }
+  return result;
+}
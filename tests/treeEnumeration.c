@@ -0,0 +1,103 @@
+#define main xmain
+#include "../iteration2.c"
+
+#undef main
+
+int result = 0;
+
+// Trees with 4 numbers and 3 operators: the shapes are the 5 ways to
+// parenthesize 4 operands, every shape takes the numbers in any of 24
+// orders and every operator is any of 4 kinds.
+enum {
+  shape_count = 5,
+  order_count = 4 * 3 * 2,
+  expected_trees = shape_count * order_count * 4 * 4 * 4
+};
+
+// The same tree can be packed with its operators in different slots, so
+// trees are compared by their preorder: an operator kind with a marker bit,
+// or a number index.
+static uint32_t treeKey(PackedTree tree, unsigned idx, uint32_t key,
+                        unsigned *shape) {
+  const unsigned slot = packedSlot(tree, idx);
+  if (slotKind(slot) == node_number) {
+    *shape <<= 1;
+    return key << 4 | slotNumber(slot);
+  }
+  *shape = *shape << 1 | 1;
+  key = key << 4 | 8 | slotOperator(slot);
+  key = treeKey(tree, slotLhs(slot), key, shape);
+  return treeKey(tree, slotRhs(slot), key, shape);
+}
+
+struct Enumeration {
+  unsigned visited;
+  uint32_t keys[2 * expected_trees];
+  unsigned shapes[1 << all_count];
+};
+
+static int compareKeys(const void *lhs, const void *rhs) {
+  const uint32_t a = *(const uint32_t *)lhs, b = *(const uint32_t *)rhs;
+  return a < b ? -1 : a > b;
+}
+
+static void checkTree(PackedTree tree, const int numbers[], void *data) {
+  (void)numbers;
+  struct Enumeration *enumeration = data;
+  if (enumeration->visited < tree_count &&
+      packedTreeAt(enumeration->visited) != tree) {
+    printf("%s: %d: Tree %u differs from its number\n", __FILE__, __LINE__,
+           enumeration->visited);
+    result = 1;
+  }
+  unsigned shape = 0;
+  const uint32_t key = treeKey(tree, all_count - 1, 0, &shape);
+  if (enumeration->visited < 2 * expected_trees) {
+    enumeration->keys[enumeration->visited] = key;
+  }
+  ++enumeration->visited;
+  ++enumeration->shapes[shape];
+}
+
+int main() {
+  if ((int)tree_count != (int)expected_trees) {
+    printf("%s: %d: There are %d trees instead of %d\n", __FILE__, __LINE__,
+           (int)tree_count, (int)expected_trees);
+    result = 1;
+  }
+  static struct Enumeration enumeration;
+  iteratePackedTrees((int[number_count]){1, 2, 3, 4}, checkTree, &enumeration);
+  if (enumeration.visited != expected_trees) {
+    printf("%s: %d: Visited %u trees instead of %d\n", __FILE__, __LINE__,
+           enumeration.visited, (int)expected_trees);
+    result = 1;
+  } else {
+    qsort(enumeration.keys, expected_trees, sizeof(uint32_t), compareKeys);
+    for (unsigned i = 1; i < expected_trees; ++i) {
+      if (enumeration.keys[i] == enumeration.keys[i - 1]) {
+        printf("%s: %d: Tree %x was visited twice\n", __FILE__, __LINE__,
+               enumeration.keys[i]);
+        result = 1;
+      }
+    }
+  }
+  unsigned shapes = 0;
+  for (unsigned shape = 0; shape < 1 << all_count; ++shape) {
+    if (!enumeration.shapes[shape]) {
+      continue;
+    }
+    ++shapes;
+    if (enumeration.shapes[shape] != expected_trees / shape_count) {
+      printf("%s: %d: Shape %x has %u trees instead of %d\n", __FILE__,
+             __LINE__, shape, enumeration.shapes[shape],
+             (int)(expected_trees / shape_count));
+      result = 1;
+    }
+  }
+  if (shapes != shape_count) {
+    printf("%s: %d: Found %u shapes instead of %d\n", __FILE__, __LINE__,
+           shapes, (int)shape_count);
+    result = 1;
+  }
+  return result;
+}
@@ -0,0 +1,138 @@
+#define main xmain
+#include "../iteration2.c"
+
+#undef main
+
+int result = 0;
+
+struct Puzzle {
+  int numbers[number_count];
+};
+
+// Every tree the solver visits, printed, has to verify as what it evaluates
+// to, and a correct one as its canonical form.
+static void checkTree(PackedTree tree, const int numbers[], void *data) {
+  struct KnownSolutions *known = data;
+  char answer[128], expected[128], found[128];
+  FILE *out = fmemopen(answer, sizeof(answer), "w");
+  printPackedTreeImpl(out, tree, numbers, all_count - 1);
+  fclose(out);
+  PackedTree solution;
+  int value;
+  const enum Verdict verdict =
+      verifyAnswer(answer, strlen(answer), numbers, known, &solution, &value);
+  const EvalResult res = evalPackedTree(tree, numbers, all_count - 1);
+  const enum Verdict expectedVerdict =
+      !res.valid ? verdict_invalid
+                 : res.num == target_number ? verdict_correct : verdict_wrong;
+  if (verdict != expectedVerdict ||
+      (verdict == verdict_wrong && value != res.num)) {
+    printf("%s: %d: %s verified as %d instead of %d\n", __FILE__, __LINE__,
+           answer, verdict, expectedVerdict);
+    result = 1;
+    return;
+  }
+  if (verdict != verdict_correct) {
+    return;
+  }
+  unsigned char classes[number_count];
+  numberClasses(numbers, classes);
+  canonicalizePackedTree(&tree, classes);
+  out = fmemopen(expected, sizeof(expected), "w");
+  printPackedTree(out, tree, numbers);
+  fclose(out);
+  out = fmemopen(found, sizeof(found), "w");
+  printPackedTree(out, solution, numbers);
+  fclose(out);
+  if (strcmp(expected, found) != 0) {
+    printf("%s: %d: %s verified as %s instead of %s", __FILE__, __LINE__,
+           answer, found, expected);
+    result = 1;
+  }
+}
+
+static void checkAnswer(const char *answer, const int numbers[number_count],
+                        enum Verdict expected, int line) {
+  struct KnownSolutions known;
+  initKnownSolutions(&known);
+  PackedTree solution;
+  int value;
+  const enum Verdict verdict =
+      verifyAnswer(answer, strlen(answer), numbers, &known, &solution, &value);
+  if (verdict != expected) {
+    printf("%s: %d: %s verified as %d instead of %d\n", __FILE__, line,
+           answer, verdict, expected);
+    result = 1;
+  }
+}
+
+// Both answers have to match the same known solution.
+static void checkEquivalent(const char *answer, const char *rewrite,
+                            const int numbers[number_count], int line) {
+  struct KnownSolutions known;
+  initKnownSolutions(&known);
+  PackedTree solutions[2];
+  int value;
+  if (verifyAnswer(answer, strlen(answer), numbers, &known, solutions,
+                   &value) != verdict_correct ||
+      verifyAnswer(rewrite, strlen(rewrite), numbers, &known, solutions + 1,
+                   &value) != verdict_correct ||
+      solutions[0] != solutions[1]) {
+    printf("%s: %d: %s and %s don't match the same solution\n", __FILE__,
+           line, answer, rewrite);
+    result = 1;
+  }
+}
+
+int main() {
+  static const struct Puzzle puzzles[] = {
+      {{2, 4, 7, 8}}, {{3, 3, 8, 8}}, {{1, 5, 5, 5}}, {{-3, 0, 4, 9}},
+      {{6, 6, 6, 6}}};
+  for (size_t i = 0; i < sizeof(puzzles) / sizeof(*puzzles); ++i) {
+    struct KnownSolutions known;
+    initKnownSolutions(&known);
+    iteratePackedTrees(puzzles[i].numbers, checkTree, &known);
+  }
+  const int *numbers = puzzles[0].numbers;
+  checkAnswer("4*7 - 8/2", numbers, verdict_correct, __LINE__);
+  checkAnswer(" 8 / 2 * 7 - 4 ", numbers, verdict_correct, __LINE__);
+  checkAnswer("4*7 - 8 + 2", numbers, verdict_wrong, __LINE__);
+  checkEquivalent("4*7 - 8/2", "7*4 - 8/2", numbers, __LINE__);
+  checkEquivalent("8 / 2 * 7 - 4", "7 * 8 / 2 - 4", numbers, __LINE__);
+  // Among left-deep solutions only, a balanced answer is correct but
+  // unlisted.
+  const struct TreeConstraints leftDeep = {.operators = 0xf,
+                                           .required = 0,
+                                           .maxDepth = ops_count,
+                                           .leftDeep = true};
+  struct KnownSolutions known;
+  initKnownSolutions(&known);
+  known.state.constraints = &leftDeep;
+  PackedTree solution;
+  int value;
+  if (verifyAnswer("4*7 - 8/2", strlen("4*7 - 8/2"), numbers, &known,
+                   &solution, &value) != verdict_unlisted ||
+      verifyAnswer("8 / 2 * 7 - 4", strlen("8 / 2 * 7 - 4"), numbers, &known,
+                   &solution, &value) != verdict_correct) {
+    printf("%s: %d: Answers aren't matched against the listed solutions\n",
+           __FILE__, __LINE__);
+    result = 1;
+  }
+  checkAnswer("4*7 - 7/2", numbers, verdict_mismatch, __LINE__);
+  checkAnswer("4*7 - 8/2 + 0", numbers, verdict_mismatch, __LINE__);
+  checkAnswer("4*7 - 8", numbers, verdict_mismatch, __LINE__);
+  checkAnswer("4*7 - 8/2)", numbers, verdict_malformed, __LINE__);
+  checkAnswer("4*7 - (8/2", numbers, verdict_malformed, __LINE__);
+  checkAnswer("4*7 -", numbers, verdict_malformed, __LINE__);
+  checkAnswer("", numbers, verdict_malformed, __LINE__);
+  checkAnswer("4*7 - 99999999999/2", numbers, verdict_malformed, __LINE__);
+  checkAnswer("((((((((((((((((((((((((((((((((((((((((((((((((((((((((((((((("
+              "((((((4))))))))))))))))))))))))))))))))))))))))))))))))))))))))"
+              ")))))))*7 - 8/2",
+              numbers, verdict_malformed, __LINE__);
+  checkAnswer("(-3 - 9) * (0 - 4) / 2", puzzles[3].numbers, verdict_mismatch,
+              __LINE__);
+  checkAnswer("(9 - -3) * (4 - 0)", puzzles[3].numbers, verdict_wrong,
+              __LINE__);
+  return result;
+}